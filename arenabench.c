@@ -0,0 +1,176 @@
+/*
+ * arenabench.c - Benchmark of the regions of mm-arena.c against freeing
+ *                every object with mm_free (see the arenabench target in
+ *                the Makefile).
+ *
+ * The workload is a synthetic request-scoped trace: every request
+ * allocates a random number of objects of random sizes, writes their
+ * first and last byte, and drops them all when it ends. The trace is
+ * replayed twice with the same seed, once with mm_malloc and one mm_free
+ * per object, and once with mm_arena_alloc and one mm_arena_reset per
+ * request. The benchmark prints the objects per second of each run and
+ * the heap size it needed.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+/* Parameters of a run, set from the command line */
+static long num_requests = 100000; /* number of requests */
+static int max_objects = 64;       /* largest number of objects of a request */
+static int max_size = 256;         /* largest object in bytes */
+
+/*
+ * next_random - xorshift generator, so both runs see the same trace
+ */
+static unsigned int next_random(unsigned int *state)
+{
+    unsigned int x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+/*
+ * run_trace - Replays the trace with per-object frees or with a region,
+ *     and returns the number of objects that were corrupted
+ */
+static int run_trace(int use_arena, long *objects)
+{
+    unsigned int seed = 2463534242U;
+    char **slots = calloc(max_objects, sizeof(char *));
+    int *sizes = calloc(max_objects, sizeof(int));
+    mm_arena_t *arena = NULL;
+    int errors = 0;
+
+    if (slots == NULL || sizes == NULL) {
+        fprintf(stderr, "arenabench: calloc failed\n");
+        exit(1);
+    }
+
+    if (use_arena && (arena = mm_arena_create(0)) == NULL) {
+        fprintf(stderr, "arenabench: mm_arena_create failed\n");
+        exit(1);
+    }
+
+    *objects = 0;
+    for (long r = 0; r < num_requests; r++) {
+        int n = 1 + next_random(&seed) % max_objects;
+
+        for (int i = 0; i < n; i++) {
+            int size = 1 + next_random(&seed) % max_size;
+            char tag = (char)(r + i);
+
+            slots[i] = use_arena ? mm_arena_alloc(arena, size) : mm_malloc(size);
+            if (slots[i] == NULL) {
+                fprintf(stderr, "arenabench: allocation of %d bytes failed\n", size);
+                exit(1);
+            }
+            sizes[i] = size;
+            slots[i][0] = tag;
+            slots[i][size - 1] = tag;
+        }
+
+        for (int i = 0; i < n; i++) {
+            char tag = (char)(r + i);
+
+            if (slots[i][0] != tag || slots[i][sizes[i] - 1] != tag)
+                errors++;
+            if (!use_arena)
+                mm_free(slots[i]);
+        }
+
+        if (use_arena)
+            mm_arena_reset(arena);
+        *objects += n;
+    }
+
+    if (use_arena)
+        mm_arena_destroy(arena);
+
+    free(slots);
+    free(sizes);
+    return errors;
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: arenabench [-h] [-n <requests>] [-o <objects>] [-s <size>]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h           Print this message.\n");
+    fprintf(stderr, "\t-n <requests> Number of requests.\n");
+    fprintf(stderr, "\t-o <objects> Largest number of objects of a request.\n");
+    fprintf(stderr, "\t-s <size>    Largest object in bytes.\n");
+}
+
+int main(int argc, char **argv)
+{
+    int c;
+    int errors = 0;
+    char *names[] = {"mm_free", "arena"};
+
+    while ((c = getopt(argc, argv, "hn:o:s:")) != EOF) {
+        switch (c) {
+        case 'n':
+            num_requests = atol(optarg);
+            break;
+        case 'o':
+            max_objects = atoi(optarg);
+            break;
+        case 's':
+            max_size = atoi(optarg);
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+
+    if (num_requests < 1 || max_objects < 1 || max_size < 1) {
+        usage();
+        exit(1);
+    }
+
+    mem_init();
+
+    for (int use_arena = 0; use_arena <= 1; use_arena++) {
+        struct timeval start, end;
+        long objects;
+
+        mem_reset_brk();
+        if (mm_init() < 0) {
+            fprintf(stderr, "arenabench: mm_init failed\n");
+            exit(1);
+        }
+
+        gettimeofday(&start, NULL);
+        errors += run_trace(use_arena, &objects);
+        gettimeofday(&end, NULL);
+
+        double secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+
+        printf("%-8s objects:%ld secs:%.3f Kobjects/sec:%.0f peak heap:%lu\n",
+               names[use_arena], objects, secs, objects / 1e3 / secs,
+               (unsigned long)mem_peak_heapsize());
+    }
+
+    if (errors > 0) {
+        printf("ERROR: %d objects were corrupted\n", errors);
+        exit(1);
+    }
+
+    mem_deinit();
+    return 0;
+}
@@ -53,12 +53,16 @@
 #define UTIL_WEIGHT .60
 
 /* 
- * Alignment requirement in bytes (either 4 or 8) 
+ * Alignment requirement in bytes (either 8 or 16). It can be set from
+ * the command line, e.g. "make ALIGNMENT=16"
  */
+#ifndef ALIGNMENT
 #define ALIGNMENT 8  
+#endif
 
 /* 
- * Maximum heap size in bytes 
+ * Default maximum heap size in bytes. memlib only reserves address space
+ * for it, and mdriver can change it at run time (-M)
  */
 #define MAX_HEAP (20*(1<<20))  /* 20 MB */
 
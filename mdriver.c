@@ -15,6 +15,7 @@
 #include <assert.h>
 #include <float.h>
 #include <time.h>
+#include <sys/resource.h>
 
 #include "mm.h"
 #include "memlib.h"
@@ -29,9 +30,10 @@
 #define MAXLINE     1024 /* max string size */
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
+#define BATCH_MAX     64 /* max ops replayed as one batch (set by -b) */
 
 /* Returns true if p is ALIGNMENT-byte aligned */
-#define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
+#define IS_ALIGNED(p)  ((((unsigned long)(p)) % ALIGNMENT) == 0)
 
 /****************************** 
  * The key compound data types 
@@ -41,14 +43,26 @@
 typedef struct range_t {
     char *lo;              /* low payload address */
     char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    struct range_t *left;  /* ranges below lo, or the next unused node */
+    struct range_t *right; /* ranges above lo */
+    unsigned int priority; /* treap priority, a hash of lo */
 } range_t;
 
+/* The payload extents of a trace, a treap ordered by address whose nodes
+   come from a pool that is allocated once per trace */
+typedef struct {
+    range_t *root;
+    range_t *pool;         /* preallocated nodes */
+    range_t *unused;       /* nodes of the pool that are not in the tree */
+    int pool_size;
+} ranges_t;
+
 /* Characterizes a single trace operation (allocator request) */
 typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
+    enum {ALLOC, FREE, REALLOC, MEMALIGN} type; /* type of request */
     int index;                        /* index for free() to use later */
     int size;                         /* byte size of alloc/realloc request */
+    int align;                        /* alignment of memalign request */
 } traceop_t;
 
 /* Holds the information for one trace file*/
@@ -69,7 +83,7 @@ typedef struct {
  */
 typedef struct {
     trace_t *trace;  
-    range_t *ranges;
+    ranges_t *ranges;
 } speed_t;
 
 /* Summarizes the important stats for some malloc function on some trace */
@@ -78,9 +92,16 @@ typedef struct {
     double ops;      /* number of ops (malloc/free/realloc) in the trace */
     int valid;       /* was the trace processed correctly by the allocator? */
     double secs;     /* number of secs needed to run the trace */
+    double sized_secs; /* ... with single frees by mm_free_sized (only with -s) */
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    size_t peak_heap;  /* largest heap size during the utilization run */
+    size_t final_heap; /* heap size at the end of the utilization run */
+    size_t peak_resident; /* largest resident size during the utilization run */
+    size_t final_resident; /* resident size at the end of the utilization run */
+    long faults;     /* minor page faults during the utilization run */
+    mm_stats_t mm;   /* counters of the mm package after the utilization run */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
@@ -90,6 +111,9 @@ typedef struct {
  *******************/
 int verbose = 0;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
+static int batch_mode = 0; /* If set, replay runs of ops as batches (set by -b) */
+static int compare_sized = 0; /* If set, time mm_free and mm_free_sized (set by -s) */
+static int sized_frees = 0; /* If set, single frees use mm_free_sized */
 char msg[MAXLINE*2];      /* for whenever we need to compose an error message */
 
 /* Directory where default tracefiles are found */
@@ -100,16 +124,27 @@ static char *default_tracefiles[] = {
     DEFAULT_TRACEFILES, NULL
 };
 
+/* The fit policies of the mm package that are compared by -p */
+static struct {
+    mm_fit_policy_t policy;
+    char *name;
+} fit_policies[] = {
+    {MM_FIT_FIRST, "first"},
+    {MM_FIT_BEST, "best"},
+    {MM_FIT_GOOD, "good"},
+    {MM_FIT_ADDRESS, "address"}
+};
+
 
 /********************* 
  * Function prototypes 
  *********************/
 
-/* these functions manipulate range lists */
-static int add_range(range_t **ranges, char *lo, int size, 
+/* these functions manipulate the range tree */
+static int add_range(ranges_t *ranges, char *lo, int size, 
 		     int tracenum, int opnum);
-static void remove_range(range_t **ranges, char *lo);
-static void clear_ranges(range_t **ranges);
+static void remove_range(ranges_t *ranges, char *lo);
+static void clear_ranges(ranges_t *ranges, int num_ranges);
 
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(char *tracedir, char *filename);
@@ -121,12 +156,25 @@ static void eval_libc_speed(void *ptr);
 
 /* Routines for evaluating correctnes, space utilization, and speed 
    of the student's malloc package in mm.c */
-static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
+static int eval_mm_valid(trace_t *trace, int tracenum, ranges_t *ranges);
+static double eval_mm_util(trace_t *trace, int tracenum, ranges_t *ranges);
 static void eval_mm_speed(void *ptr);
+static int batch_length(trace_t *trace, int i);
+static int replay_mallocs(trace_t *trace, int i, int n);
+static void replay_frees(trace_t *trace, int i, int n);
+static void eval_mm(char **tracefiles, int num_tracefiles, stats_t *stats,
+		    ranges_t *ranges);
+static size_t resident_limit(void);
+static void eval_fit_policies(char **tracefiles, int num_tracefiles, 
+			      ranges_t *ranges);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void printquick(int n, stats_t *stats);
+static void printcopies(int n, stats_t *stats);
+static void printfootprint(int n, stats_t *stats);
+static void printresident(int n, stats_t *stats);
+static void printsized(int n, stats_t *stats);
 static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
@@ -142,7 +190,7 @@ int main(int argc, char **argv)
     char **tracefiles = NULL;  /* null-terminated array of trace file names */
     int num_tracefiles = 0;    /* the number of traces in that array */
     trace_t *trace = NULL;     /* stores a single trace file in memory */
-    range_t *ranges = NULL;    /* keeps track of block extents for one trace */
+    ranges_t ranges = {0};     /* keeps track of block extents for one trace */
     stats_t *libc_stats = NULL;/* libc stats for each trace */
     stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
     speed_t speed_params;      /* input parameters to the xx_speed routines */ 
@@ -150,6 +198,10 @@ int main(int argc, char **argv)
     int team_check = 1;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int compare_policies = 0; /* If set, run every fit policy (set by -p) */
+    size_t max_heap = 0; /* Heap limit in bytes, 0 for MAX_HEAP (set by -M) */
+    int mem_flags = 0;   /* MEM_xxx flags of memlib (set by -H) */
+    int purge_decay = -1; /* Purge decay of mm malloc, -1 for its default (set by -P) */
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -158,7 +210,7 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:hvVgalpbsM:HP:")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -184,6 +236,32 @@ int main(int argc, char **argv)
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 'b': /* Replay runs of mallocs and frees as batches */
+            batch_mode = 1;
+            break;
+        case 's': /* Time the frees with and without the block sizes */
+            compare_sized = 1;
+            break;
+        case 'M': /* Heap limit in megabytes */
+            max_heap = (size_t)atol(optarg) << 20;
+            if (max_heap == 0) {
+		usage();
+		exit(1);
+	    }
+            break;
+        case 'H': /* Back the heap with transparent huge pages */
+            mem_flags |= MEM_HUGE_PAGES;
+            break;
+        case 'P': /* Frees before idle free pages are purged */
+            purge_decay = atoi(optarg);
+            if (purge_decay < 0) {
+		usage();
+		exit(1);
+	    }
+            break;
+        case 'p': /* Compare the fit policies of the mm package */
+            compare_policies = 1;
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -285,35 +363,42 @@ int main(int argc, char **argv)
 	unix_error("mm_stats calloc in main failed");
     
     /* Initialize the simulated memory system in memlib.c */
+    mem_configure(max_heap, mem_flags);
     mem_init(); 
+    if (purge_decay >= 0)
+	mm_set_purge_decay(purge_decay);
 
     /* Evaluate student's mm malloc package using the K-best scheme */
-    for (i=0; i < num_tracefiles; i++) {
-	trace = read_trace(tracedir, tracefiles[i]);
-	mm_stats[i].ops = trace->num_ops;
-	if (verbose > 1)
-	    printf("Checking mm_malloc for correctness, ");
-	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
-	if (mm_stats[i].valid) {
-	    if (verbose > 1)
-		printf("efficiency, ");
-	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
-	    speed_params.trace = trace;
-	    speed_params.ranges = ranges;
-	    if (verbose > 1)
-		printf("and performance.\n");
-	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
-	}
-	free_trace(trace);
-    }
+    eval_mm(tracefiles, num_tracefiles, mm_stats, &ranges);
 
     /* Display the mm results in a compact table */
     if (verbose) {
 	printf("\nResults for mm malloc:\n");
 	printresults(num_tracefiles, mm_stats);
+	printf("\nQuick lists of mm malloc:\n");
+	printquick(num_tracefiles, mm_stats);
+	printf("\nReallocs of mm malloc:\n");
+	printcopies(num_tracefiles, mm_stats);
+	printf("\nFootprint of mm malloc:\n");
+	printfootprint(num_tracefiles, mm_stats);
+	printf("\nResidency of mm malloc:\n");
+	printresident(num_tracefiles, mm_stats);
 	printf("\n");
     }
 
+    /* Display the throughput of both kinds of frees side by side */
+    if (compare_sized) {
+	printf("\nKops with mm_free and mm_free_sized:\n");
+	printsized(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+
+    /*
+     * Optionally evaluate the mm package once with every fit policy
+     */
+    if (compare_policies)
+	eval_fit_policies(tracefiles, num_tracefiles, &ranges);
+
     /* 
      * Accumulate the aggregate statistics for the student's mm package 
      */
@@ -367,22 +452,26 @@ int main(int argc, char **argv)
 
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps 
+ * The following routines manipulate the range tree, which keeps 
  * track of the extent of every allocated block payload. We use the 
- * range list to detect any overlapping allocated blocks.
+ * range tree to detect any overlapping allocated blocks. The payloads
+ * are disjoint, so a new one can only overlap the payloads that start
+ * just below and just above it, and both are found in one descent.
  ****************************************************************/
 
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of 
  *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list. 
+ *     we take a range struct from the pool for this block and insert it
+ *     into the range tree. 
  */
-static int add_range(range_t **ranges, char *lo, int size, 
+static int add_range(ranges_t *ranges, char *lo, int size, 
 		     int tracenum, int opnum)
 {
     char *hi = lo + size - 1;
-    range_t *p;
+    range_t *p, *cur, *below = NULL, *above = NULL;
+    range_t **link, **left, **right;
     char msg[MAXLINE];
 
     assert(size > 0);
@@ -395,9 +484,11 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
-	(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The payload must lie within the extent of the heap or of a region
+     * that memlib mapped */
+    if (((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
+	 (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) &&
+	!mem_in_mapping(lo, hi)) {
 	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
 		lo, hi, mem_heap_lo(), mem_heap_hi());
 	malloc_error(tracenum, opnum, msg);
@@ -405,62 +496,118 @@ static int add_range(range_t **ranges, char *lo, int size,
     }
 
     /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-	    sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-		    lo, hi, p->lo, p->hi);
-	    malloc_error(tracenum, opnum, msg);
-	    return 0;
-        }
+    for (p = ranges->root;  p != NULL;  ) {
+	if (p->lo <= lo) {
+	    below = p;
+	    p = p->right;
+	}
+	else {
+	    above = p;
+	    p = p->left;
+	}
+    }
+    p = (below != NULL && below->hi >= lo) ? below :
+	(above != NULL && above->lo <= hi) ? above : NULL;
+    if (p != NULL) {
+	sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+		lo, hi, p->lo, p->hi);
+	malloc_error(tracenum, opnum, msg);
+	return 0;
     }
 
     /* 
      * Everything looks OK, so remember the extent of this block 
-     * by creating a range struct and adding it the range list.
+     * by taking a range struct from the pool and adding it to the tree.
      */
-    if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
-	unix_error("malloc error in add_range");
-    p->next = *ranges;
+    if ((p = ranges->unused) == NULL)
+	app_error("range pool exhausted in add_range");
+    ranges->unused = p->left;
     p->lo = lo;
     p->hi = hi;
-    *ranges = p;
+    p->priority = (unsigned int)((unsigned long)lo >> 3) * 2654435761U;
+
+    /* Go down to the first node with a lower priority, which p replaces,
+       and split the subtree of that node into the parts below and above p */
+    link = &ranges->root;
+    while (*link != NULL && (*link)->priority > p->priority)
+	link = (lo < (*link)->lo) ? &(*link)->left : &(*link)->right;
+
+    left = &p->left;
+    right = &p->right;
+    for (cur = *link;  cur != NULL;  ) {
+	if (cur->lo < lo) {
+	    *left = cur;
+	    left = &cur->right;
+	    cur = cur->right;
+	}
+	else {
+	    *right = cur;
+	    right = &cur->left;
+	    cur = cur->left;
+	}
+    }
+    *left = NULL;
+    *right = NULL;
+    *link = p;
     return 1;
 }
 
 /* 
- * remove_range - Free the range record of block whose payload starts at lo 
+ * remove_range - Give back the range record of block whose payload 
+ *     starts at lo. Its subtrees are merged into the one that takes its
+ *     place.
  */
-static void remove_range(range_t **ranges, char *lo)
+static void remove_range(ranges_t *ranges, char *lo)
 {
-    range_t *p;
-    range_t **prevpp = ranges;
-    //int size;
-
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-	    *prevpp = p->next;
-            //size = p->hi - p->lo + 1;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
+    range_t *p, *left, *right;
+    range_t **link = &ranges->root;
+
+    while (*link != NULL && (*link)->lo != lo)
+	link = (lo < (*link)->lo) ? &(*link)->left : &(*link)->right;
+    if ((p = *link) == NULL)
+	return;
+
+    left = p->left;
+    right = p->right;
+    while (left != NULL && right != NULL) {
+	if (left->priority > right->priority) {
+	    *link = left;
+	    link = &left->right;
+	    left = left->right;
+	}
+	else {
+	    *link = right;
+	    link = &right->left;
+	    right = right->left;
+	}
     }
+    *link = (left != NULL) ? left : right;
+
+    p->left = ranges->unused;
+    ranges->unused = p;
 }
 
 /*
- * clear_ranges - free all of the range records for a trace 
+ * clear_ranges - empty the range tree for a trace with room for 
+ *     num_ranges payloads at once
  */
-static void clear_ranges(range_t **ranges)
+static void clear_ranges(ranges_t *ranges, int num_ranges)
 {
-    range_t *p;
-    range_t *pnext;
+    int i;
 
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
-        free(p);
+    if (num_ranges > ranges->pool_size) {
+	free(ranges->pool);
+	if ((ranges->pool = (range_t *)malloc(num_ranges * sizeof(range_t))) == NULL)
+	    unix_error("malloc error in clear_ranges");
+	ranges->pool_size = num_ranges;
+    }
+
+    ranges->root = NULL;
+    ranges->unused = NULL;
+    for (i = ranges->pool_size - 1;  i >= 0;  i--) {
+	ranges->pool[i].left = ranges->unused;
+	ranges->unused = &ranges->pool[i];
     }
-    *ranges = NULL;
 }
 
 
@@ -477,7 +624,7 @@ static trace_t *read_trace(char *tracedir, char *filename)
     trace_t *trace;
     char type[MAXLINE];
     char path[MAXLINE];
-    unsigned index, size;
+    unsigned index, size, align;
     unsigned max_index = 0;
     unsigned op_index;
 
@@ -534,6 +681,14 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	    trace->ops[op_index].size = size;
 	    max_index = (index > max_index) ? index : max_index;
 	    break;
+	case 'm':
+	    fscanf(tracefile, "%u %u %u", &index, &align, &size);
+	    trace->ops[op_index].type = MEMALIGN;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = size;
+	    trace->ops[op_index].align = align;
+	    max_index = (index > max_index) ? index : max_index;
+	    break;
 	case 'f':
 	    fscanf(tracefile, "%ud", &index);
 	    trace->ops[op_index].type = FREE;
@@ -574,9 +729,9 @@ void free_trace(trace_t *trace)
 /*
  * eval_mm_valid - Check the mm malloc package for correctness
  */
-static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges) 
+static int eval_mm_valid(trace_t *trace, int tracenum, ranges_t *ranges) 
 {
-    int i, j;
+    int i, j, k, n;
     int index;
     int size;
     int oldsize;
@@ -586,7 +741,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
     
     /* Reset the heap and free any records in the range list */
     mem_reset_brk();
-    clear_ranges(ranges);
+    clear_ranges(ranges, trace->num_ids);
 
     /* Call the mm package's init function */
     if (mm_init() < 0) {
@@ -595,33 +750,59 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
     }
 
     /* Interpret each operation in the trace in order */
-    for (i = 0;  i < trace->num_ops;  i++) {
+    for (i = 0;  i < trace->num_ops;  i += n) {
 	index = trace->ops[i].index;
 	size = trace->ops[i].size;
+	n = batch_length(trace, i);
 
         switch (trace->ops[i].type) {
 
         case ALLOC: /* mm_malloc */
 
 	    /* Call the student's malloc */
-	    if ((p = mm_malloc(size)) == NULL) {
-		malloc_error(tracenum, i, "mm_malloc failed.");
+	    if ((k = replay_mallocs(trace, i, n)) < n) {
+		malloc_error(tracenum, i + k, "mm_malloc failed.");
 		return 0;
 	    }
 	    
-	    /* 
-	     * Test the range of the new block for correctness and add it 
-	     * to the range list if OK. The block must be  be aligned properly,
-	     * and must not overlap any currently allocated block. 
-	     */ 
+	    for (k = i; k < i + n; k++) {
+		index = trace->ops[k].index;
+		p = trace->blocks[index];
+
+		/* 
+		 * Test the range of the new block for correctness and add it 
+		 * to the range list if OK. The block must be  be aligned 
+		 * properly, and must not overlap any currently allocated block. 
+		 */ 
+		if (add_range(ranges, p, size, tracenum, k) == 0)
+		    return 0;
+	    
+		/* ADDED: cgw
+		 * fill range with low byte of index.  This will be used later
+		 * if we realloc the block and wish to make sure that the old
+		 * data was copied to the new block
+		 */
+		memset(p, index & 0xFF, size);
+	    }
+	    break;
+
+        case MEMALIGN: /* mm_memalign */
+
+	    /* Call the student's memalign */
+	    if ((p = mm_memalign(trace->ops[i].align, size)) == NULL) {
+		malloc_error(tracenum, i, "mm_memalign failed.");
+		return 0;
+	    }
+
+	    /* The payload must have the requested alignment as well */
+	    if (((unsigned long)p & (trace->ops[i].align - 1)) != 0) {
+		malloc_error(tracenum, i, "Payload is not aligned as requested.");
+		return 0;
+	    }
+
 	    if (add_range(ranges, p, size, tracenum, i) == 0)
 		return 0;
-	    
-	    /* ADDED: cgw
-	     * fill range with low byte of index.  This will be used later
-	     * if we realloc the block and wish to make sure that the old
-	     * data was copied to the new block
-	     */
+
 	    memset(p, index & 0xFF, size);
 
 	    /* Remember region */
@@ -668,10 +849,10 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 
         case FREE: /* mm_free */
 	    
-	    /* Remove region from list and call student's free function */
-	    p = trace->blocks[index];
-	    remove_range(ranges, p);
-	    mm_free(p);
+	    /* Remove regions from list and call student's free function */
+	    for (k = i; k < i + n; k++)
+		remove_range(ranges, trace->blocks[trace->ops[k].index]);
+	    replay_frees(trace, i, n);
 	    break;
 
 	default:
@@ -695,9 +876,9 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   is always the high water mark of the heap. 
  *   
  */
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
+static double eval_mm_util(trace_t *trace, int tracenum, ranges_t *ranges)
 {   
-    int i;
+    int i, k, n;
     int index;
     int size, newsize, oldsize;
     int max_total_size = 0;
@@ -705,34 +886,50 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
     char *p;
     char *newp, *oldp;
 
-    /* initialize the heap and the mm malloc package */
+    /* initialize the heap and the mm malloc package. The heap starts
+       with no page resident, so every page it touches is counted */
     mem_reset_brk();
+    mem_reset_resident();
     if (mm_init() < 0)
 	app_error("mm_init failed in eval_mm_util");
 
-    for (i = 0;  i < trace->num_ops;  i++) {
+    for (i = 0;  i < trace->num_ops;  i += n) {
+	n = batch_length(trace, i);
+
         switch (trace->ops[i].type) {
 
         case ALLOC: /* mm_alloc */
-	    index = trace->ops[i].index;
 	    size = trace->ops[i].size;
 
-	    if ((p = mm_malloc(size)) == NULL) 
+	    if (replay_mallocs(trace, i, n) < n) 
 		app_error("mm_malloc failed in eval_mm_util");
 	    
-	    /* Remember region and size */
-	    trace->blocks[index] = p;
-	    trace->block_sizes[index] = size;
-	    
 	    /* Keep track of current total size
 	     * of all allocated blocks */
-	    total_size += size;
+	    total_size += n * size;
 	    
 	    /* Update statistics */
 	    max_total_size = (total_size > max_total_size) ?
 		total_size : max_total_size;
 	    break;
 
+        case MEMALIGN: /* mm_memalign */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+
+	    if ((p = mm_memalign(trace->ops[i].align, size)) == NULL) 
+		app_error("mm_memalign failed in eval_mm_util");
+
+	    /* Remember region and size */
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+
+	    /* Only the payload counts, not the alignment */
+	    total_size += size;
+	    max_total_size = (total_size > max_total_size) ?
+		total_size : max_total_size;
+	    break;
+
 	case REALLOC: /* mm_realloc */
 	    index = trace->ops[i].index;
 	    newsize = trace->ops[i].size;
@@ -756,16 +953,12 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    break;
 
         case FREE: /* mm_free */
-	    index = trace->ops[i].index;
-	    size = trace->block_sizes[index];
-	    p = trace->blocks[index];
-	    
-	    mm_free(p);
-	    
 	    /* Keep track of current total size
 	     * of all allocated blocks */
-	    total_size -= size;
-	    
+	    for (k = i; k < i + n; k++)
+		total_size -= trace->block_sizes[trace->ops[k].index];
+
+	    replay_frees(trace, i, n);
 	    break;
 
 	default:
@@ -774,7 +967,8 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
         }
     }
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    /* The heap may have shrunk again, so the peak of the heap is used */
+    return ((double)max_total_size / (double)mem_peak_heapsize());
 }
 
 
@@ -784,8 +978,8 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
  */
 static void eval_mm_speed(void *ptr)
 {
-    int i, index, size, newsize;
-    char *p, *newp, *oldp, *block;
+    int i, n, index, newsize;
+    char *newp, *oldp;
     trace_t *trace = ((speed_t *)ptr)->trace;
 
     /* Reset the heap and initialize the mm package */
@@ -794,15 +988,22 @@ static void eval_mm_speed(void *ptr)
 	app_error("mm_init failed in eval_mm_speed");
 
     /* Interpret each trace request */
-    for (i = 0;  i < trace->num_ops;  i++)
+    for (i = 0;  i < trace->num_ops;  i += n) {
+	n = batch_length(trace, i);
+
         switch (trace->ops[i].type) {
 
         case ALLOC: /* mm_malloc */
-            index = trace->ops[i].index;
-            size = trace->ops[i].size;
-            if ((p = mm_malloc(size)) == NULL)
+            if (replay_mallocs(trace, i, n) < n)
 		app_error("mm_malloc error in eval_mm_speed");
-            trace->blocks[index] = p;
+            break;
+
+        case MEMALIGN: /* mm_memalign */
+            index = trace->ops[i].index;
+            if ((newp = mm_memalign(trace->ops[i].align, trace->ops[i].size)) == NULL)
+		app_error("mm_memalign error in eval_mm_speed");
+            trace->blocks[index] = newp;
+            trace->block_sizes[index] = trace->ops[i].size;
             break;
 
 	case REALLOC: /* mm_realloc */
@@ -812,17 +1013,86 @@ static void eval_mm_speed(void *ptr)
             if ((newp = mm_realloc(oldp,newsize)) == NULL)
 		app_error("mm_realloc error in eval_mm_speed");
             trace->blocks[index] = newp;
+            trace->block_sizes[index] = newsize;
             break;
 
         case FREE: /* mm_free */
-            index = trace->ops[i].index;
-            block = trace->blocks[index];
-            mm_free(block);
+            replay_frees(trace, i, n);
             break;
 
 	default:
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
+    }
+}
+
+/*
+ * batch_length - Returns the number of ops from op i on that are replayed
+ *    together: a run of mallocs of the same size or a run of frees, up to
+ *    BATCH_MAX. Every op is replayed on its own unless -b is given.
+ */
+static int batch_length(trace_t *trace, int i)
+{
+    int n = 1;
+    traceop_t *op = &trace->ops[i];
+
+    if (!batch_mode || (op->type != ALLOC && op->type != FREE))
+	return 1;
+
+    while (i + n < trace->num_ops && n < BATCH_MAX &&
+	   op[n].type == op->type &&
+	   (op->type == FREE || op[n].size == op->size))
+	n++;
+
+    return n;
+}
+
+/*
+ * replay_mallocs - Replays the n mallocs from op i on, with mm_malloc_batch
+ *    if there are several, and remembers the blocks and their sizes.
+ *    Returns the number of blocks that were allocated.
+ */
+static int replay_mallocs(trace_t *trace, int i, int n)
+{
+    void *blocks[BATCH_MAX];
+    int k, count;
+    int size = trace->ops[i].size;
+
+    if (n == 1)
+	count = (blocks[0] = mm_malloc(size)) != NULL;
+    else
+	count = mm_malloc_batch(size, n, blocks);
+
+    for (k = 0; k < count; k++) {
+	trace->blocks[trace->ops[i + k].index] = blocks[k];
+	trace->block_sizes[trace->ops[i + k].index] = size;
+    }
+
+    return count;
+}
+
+/*
+ * replay_frees - Replays the n frees from op i on, with mm_free_batch if
+ *    there are several. A single free passes the size of the block to
+ *    mm_free_sized in the sized runs of -s.
+ */
+static void replay_frees(trace_t *trace, int i, int n)
+{
+    void *blocks[BATCH_MAX];
+    int k, index = trace->ops[i].index;
+
+    if (n == 1) {
+	if (sized_frees)
+	    mm_free_sized(trace->blocks[index], trace->block_sizes[index]);
+	else
+	    mm_free(trace->blocks[index]);
+	return;
+    }
+
+    for (k = 0; k < n; k++)
+	blocks[k] = trace->blocks[trace->ops[i + k].index];
+
+    mm_free_batch(blocks, n);
 }
 
 /*
@@ -847,6 +1117,15 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
 	    trace->blocks[trace->ops[i].index] = p;
 	    break;
 
+	case MEMALIGN: /* posix_memalign */
+	    if (posix_memalign((void **)&p, trace->ops[i].align, 
+			       trace->ops[i].size) != 0) {
+		malloc_error(tracenum, i, "libc posix_memalign failed");
+		unix_error("System message");
+	    }
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+
 	case REALLOC: /* realloc */
             newsize = trace->ops[i].size;
 	    oldp = trace->blocks[trace->ops[i].index];
@@ -891,6 +1170,14 @@ static void eval_libc_speed(void *ptr)
 	    trace->blocks[index] = p;
 	    break;
 
+	case MEMALIGN: /* posix_memalign */
+	    index = trace->ops[i].index;
+	    if (posix_memalign((void **)&p, trace->ops[i].align, 
+			       trace->ops[i].size) != 0)
+		unix_error("posix_memalign failed in eval_libc_speed");
+	    trace->blocks[index] = p;
+	    break;
+
 	case REALLOC: /* realloc */
 	    index = trace->ops[i].index;
 	    newsize = trace->ops[i].size;
@@ -915,6 +1202,142 @@ static void eval_libc_speed(void *ptr)
  ************************************/
 
 
+/*
+ * eval_mm - Evaluate the correctness, utilization and throughput of the
+ * mm package on every trace, storing the results in stats
+ */
+static void eval_mm(char **tracefiles, int num_tracefiles, stats_t *stats,
+		    ranges_t *ranges)
+{
+    int i;
+    trace_t *trace;
+    speed_t speed_params;
+    struct rusage before, after;
+
+    for (i=0; i < num_tracefiles; i++) {
+	trace = read_trace(tracedir, tracefiles[i]);
+	stats[i].ops = trace->num_ops;
+
+	/* With -s the sized frees are checked as well */
+	sized_frees = compare_sized;
+	if (verbose > 1)
+	    printf("Checking mm_malloc for correctness, ");
+	stats[i].valid = eval_mm_valid(trace, i, ranges);
+	if (stats[i].valid) {
+	    if (verbose > 1)
+		printf("efficiency, ");
+	    getrusage(RUSAGE_SELF, &before);
+	    stats[i].util = eval_mm_util(trace, i, ranges);
+	    getrusage(RUSAGE_SELF, &after);
+	    stats[i].faults = after.ru_minflt - before.ru_minflt;
+	    stats[i].peak_resident = mem_peak_resident();
+	    stats[i].final_resident = mem_resident();
+	    stats[i].peak_heap = mem_peak_heapsize();
+	    stats[i].final_heap = mem_heapsize() + mem_mapsize();
+	    mm_get_stats(&stats[i].mm);
+
+	    /* The pages that the heap gave back when it shrank must have
+	       left memory */
+	    if (stats[i].final_resident > resident_limit()) {
+		malloc_error(i, trace->num_ops - 1,
+			     "pages beyond the end of the heap are resident");
+		stats[i].valid = 0;
+		free_trace(trace);
+		continue;
+	    }
+
+	    speed_params.trace = trace;
+	    speed_params.ranges = ranges;
+	    if (verbose > 1)
+		printf("and performance.\n");
+	    sized_frees = 0;
+	    stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+	    if (compare_sized) {
+		sized_frees = 1;
+		stats[i].sized_secs = fsecs(eval_mm_speed, &speed_params);
+	    }
+	}
+	free_trace(trace);
+    }
+}
+
+/*
+ * resident_limit - Returns the most bytes that may be resident once the
+ * mm package is done: the heap up to the end of its last commit unit 
+ * (a page, or a huge page with -H) and the mapped regions
+ */
+static size_t resident_limit(void)
+{
+    size_t unit = mem_commitsize();
+
+    return (mem_heapsize() + unit - 1) / unit * unit + mem_mapsize();
+}
+
+/*
+ * eval_fit_policies - Evaluate the mm package with each of its fit 
+ * policies and print the utilization and throughput of every policy
+ */
+static void eval_fit_policies(char **tracefiles, int num_tracefiles, 
+			      ranges_t *ranges)
+{
+    int i, j;
+    int num_policies = sizeof(fit_policies) / sizeof(fit_policies[0]);
+    stats_t *stats;   /* stats of one policy for each trace */
+    stats_t *totals;  /* aggregate stats of each policy */
+
+    stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
+    totals = (stats_t *)calloc(num_policies, sizeof(stats_t));
+    if (stats == NULL || totals == NULL)
+	unix_error("policy stats calloc in eval_fit_policies failed");
+
+    for (i=0; i < num_policies; i++) {
+	if (verbose > 1)
+	    printf("\nTesting mm malloc with the %s fit policy\n", 
+		   fit_policies[i].name);
+
+	mm_set_fit_policy(fit_policies[i].policy, 0);
+	eval_mm(tracefiles, num_tracefiles, stats, ranges);
+
+	if (verbose) {
+	    printf("\nResults for the %s fit policy:\n", fit_policies[i].name);
+	    printresults(num_tracefiles, stats);
+	}
+
+	totals[i].valid = 1;
+	for (j=0; j < num_tracefiles; j++) {
+	    if (stats[j].valid) {
+		totals[i].ops += stats[j].ops;
+		totals[i].secs += stats[j].secs;
+		totals[i].util += stats[j].util;
+	    }
+	    else
+		totals[i].valid = 0;
+	}
+    }
+
+    /* Go back to the default policy */
+    mm_set_fit_policy(MM_FIT_FIRST, 0);
+
+    printf("\nResults per fit policy:\n");
+    printf("%-8s%6s%8s%10s%6s\n", "policy", "util", "ops", "secs", "Kops");
+    for (i=0; i < num_policies; i++) {
+	if (totals[i].valid)
+	    printf("%-8s%5.0f%%%8.0f%10.6f%6.0f\n",
+		   fit_policies[i].name,
+		   (totals[i].util/num_tracefiles)*100.0,
+		   totals[i].ops,
+		   totals[i].secs,
+		   (totals[i].ops/1e3)/totals[i].secs);
+	else
+	    printf("%-8s%6s%8s%10s%6s\n", 
+		   fit_policies[i].name, "-", "-", "-", "-");
+    }
+    printf("\n");
+
+    free(stats);
+    free(totals);
+}
+
 /*
  * printresults - prints a performance summary for some malloc package
  */
@@ -972,6 +1395,193 @@ static void printresults(int n, stats_t *stats)
 
 }
 
+/*
+ * printquick - prints how many of the mallocs of each trace were served
+ * by the quick lists of the mm package
+ */
+static void printquick(int n, stats_t *stats)
+{
+    int i;
+    double lookups = 0;
+    double hits = 0;
+    double consolidations = 0;
+
+    printf("%5s%9s%9s%6s%8s\n", 
+	   "trace", "lookups", "hits", "rate", "consol");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid) {
+	    printf("%2d%12lu%9lu%5.0f%%%8lu\n", 
+		   i,
+		   stats[i].mm.quick_lookups,
+		   stats[i].mm.quick_hits,
+		   stats[i].mm.quick_lookups ? 
+		   100.0 * stats[i].mm.quick_hits / stats[i].mm.quick_lookups : 0.0,
+		   stats[i].mm.consolidations);
+	    lookups += stats[i].mm.quick_lookups;
+	    hits += stats[i].mm.quick_hits;
+	    consolidations += stats[i].mm.consolidations;
+	}
+	else {
+	    printf("%2d%12s%9s%6s%8s\n", i, "-", "-", "-", "-");
+	}
+    }
+
+    printf("%5s%9.0f%9.0f%5.0f%%%8.0f\n", 
+	   "Total",
+	   lookups,
+	   hits,
+	   lookups ? 100.0 * hits / lookups : 0.0,
+	   consolidations);
+}
+
+/*
+ * printcopies - prints how many of the reallocs of each trace had to move
+ * the block and how many bytes the mm package copied for them
+ */
+static void printcopies(int n, stats_t *stats)
+{
+    int i;
+    double reallocs = 0;
+    double moves = 0;
+    double copied = 0;
+
+    printf("%5s%9s%9s%6s%11s\n", 
+	   "trace", "reallocs", "moved", "rate", "copied");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid) {
+	    printf("%2d%12lu%9lu%5.0f%%%11lu\n", 
+		   i,
+		   stats[i].mm.reallocs,
+		   stats[i].mm.realloc_moves,
+		   stats[i].mm.reallocs ? 
+		   100.0 * stats[i].mm.realloc_moves / stats[i].mm.reallocs : 0.0,
+		   stats[i].mm.bytes_copied);
+	    reallocs += stats[i].mm.reallocs;
+	    moves += stats[i].mm.realloc_moves;
+	    copied += stats[i].mm.bytes_copied;
+	}
+	else {
+	    printf("%2d%12s%9s%6s%11s\n", i, "-", "-", "-", "-");
+	}
+    }
+
+    printf("%5s%9.0f%9.0f%5.0f%%%11.0f\n", 
+	   "Total",
+	   reallocs,
+	   moves,
+	   reallocs ? 100.0 * moves / reallocs : 0.0,
+	   copied);
+}
+
+/*
+ * printsized - prints the throughput of each trace when single blocks are
+ * freed with mm_free and when they are freed with mm_free_sized
+ */
+static void printsized(int n, stats_t *stats)
+{
+    int i;
+    double ops = 0;
+    double secs = 0;
+    double sized_secs = 0;
+
+    printf("%5s%9s%10s%11s\n", "trace", "ops", "free", "sized");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid) {
+	    printf("%2d%12.0f%10.0f%11.0f\n", 
+		   i,
+		   stats[i].ops,
+		   (stats[i].ops/1e3)/stats[i].secs,
+		   (stats[i].ops/1e3)/stats[i].sized_secs);
+	    ops += stats[i].ops;
+	    secs += stats[i].secs;
+	    sized_secs += stats[i].sized_secs;
+	}
+	else {
+	    printf("%2d%12s%10s%11s\n", i, "-", "-", "-");
+	}
+    }
+
+    printf("%5s%9.0f%10.0f%11.0f\n", 
+	   "Total",
+	   ops,
+	   secs ? (ops/1e3)/secs : 0.0,
+	   sized_secs ? (ops/1e3)/sized_secs : 0.0);
+}
+
+/*
+ * printfootprint - prints the peak and the final heap size of each trace
+ * and how often the mm package extended and shrank the heap
+ */
+static void printfootprint(int n, stats_t *stats)
+{
+    int i;
+    double peak = 0;
+    double final = 0;
+    double extensions = 0;
+    double trims = 0;
+
+    printf("%5s%10s%10s%7s%7s\n", "trace", "peak", "final", "sbrks", "trims");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid) {
+	    printf("%2d%13lu%10lu%7lu%7lu\n", 
+		   i,
+		   (unsigned long)stats[i].peak_heap,
+		   (unsigned long)stats[i].final_heap,
+		   stats[i].mm.extensions,
+		   stats[i].mm.trims);
+	    peak += stats[i].peak_heap;
+	    final += stats[i].final_heap;
+	    extensions += stats[i].mm.extensions;
+	    trims += stats[i].mm.trims;
+	}
+	else {
+	    printf("%2d%13s%10s%7s%7s\n", i, "-", "-", "-", "-");
+	}
+    }
+
+    printf("%5s%10.0f%10.0f%7.0f%7.0f\n", "Total", peak, final, extensions, trims);
+}
+
+/*
+ * printresident - prints the utilization of each trace next to the 
+ * largest and the final number of bytes of the heap that were resident in
+ * memory, the minor page faults taken while the trace ran, and the 
+ * resident bytes that the mm package purged from free blocks
+ */
+static void printresident(int n, stats_t *stats)
+{
+    int i;
+    double util = 0;
+    double resident = 0;
+    double final = 0;
+    double faults = 0;
+    double purged = 0;
+
+    printf("%5s%6s%10s%10s%8s%10s\n", "trace", "util", "rss", "final", "faults", "purged");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid) {
+	    printf("%2d%8.0f%%%10lu%10lu%8ld%10lu\n", 
+		   i,
+		   stats[i].util*100.0,
+		   (unsigned long)stats[i].peak_resident,
+		   (unsigned long)stats[i].final_resident,
+		   stats[i].faults,
+		   stats[i].mm.bytes_purged);
+	    util += stats[i].util;
+	    resident += stats[i].peak_resident;
+	    final += stats[i].final_resident;
+	    faults += stats[i].faults;
+	    purged += stats[i].mm.bytes_purged;
+	}
+	else {
+	    printf("%2d%9s%10s%10s%8s%10s\n", i, "-", "-", "-", "-", "-");
+	}
+    }
+
+    printf("%5s%5.0f%%%10.0f%10.0f%8.0f%10.0f\n", "Total", 
+	   (util/n)*100.0, resident, final, faults, purged);
+}
+
 /* 
  * app_error - Report an arbitrary application error
  */
@@ -1004,13 +1614,19 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValpbsH] [-f <file>] [-t <dir>] [-M <mb>] [-P <frees>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-b         Replay runs of mallocs and frees as batches.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-H         Back the heap with transparent huge pages.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-M <mb>    Limit the heap to <mb> megabytes (default 20).\n");
+    fprintf(stderr, "\t-p         Compare the fit policies of mm malloc.\n");
+    fprintf(stderr, "\t-P <frees> Purge free pages idle for <frees> frees (0 never).\n");
+    fprintf(stderr, "\t-s         Time the frees with mm_free and mm_free_sized side by side.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
@@ -1,8 +1,33 @@
 /*
- * memlib.c - a module that simulates the memory system.  Needed because it 
- *            allows us to interleave calls from the student's malloc package 
+ * memlib.c - a module that simulates the memory system.  Needed because it
+ *            allows us to interleave calls from the student's malloc package
  *            with the system's malloc package in libc.
+ *
+ *            The heap is a range of address space that is reserved with
+ *            mmap(MAP_NORESERVE) but not accessible. mem_sbrk commits it
+ *            (makes it accessible) as the brk grows, in pages or, with
+ *            MEM_HUGE_PAGES, in 2 MiB steps of a 2 MiB aligned heap that is
+ *            advised to use transparent huge pages. The size of the range
+ *            is set at run time with mem_configure, so large heaps cost no
+ *            memory until they are used.
+ *
+ *            Besides the brk-style heap, it hands out page-granular regions
+ *            that live outside the heap (mem_map/mem_unmap), like mmap and
+ *            munmap. Neither part is thread-safe; callers must serialize.
+ *
+ *            All of the state of a heap is kept in a mem_heap_t. The
+ *            functions without the _h suffix work on the default heap that
+ *            mem_init sets up, and mem_heap_create makes further heaps that
+ *            are independent of it and of each other (the _h functions).
+ *            Different heaps may be used by different threads at once.
+ *
+ *            The pages of a heap that are resident in memory are counted
+ *            with mincore. Residency only drops when a region is unmapped,
+ *            the heap shrinks or pages are purged (mem_purge), so sampling
+ *            it just before that and when the peak is asked for gives the
+ *            exact peak.
  */
+#define _GNU_SOURCE /* mremap */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -14,82 +39,624 @@
 #include "memlib.h"
 #include "config.h"
 
+#define HUGE_PAGE_SIZE (2*(1<<20)) /* Size and alignment of a transparent huge page */
+
+/* A region handed out by mem_map */
+typedef struct mem_region {
+    char *lo;                /* first byte of the region */
+    size_t size;             /* size in bytes, a multiple of the page size */
+    struct mem_region *next;
+} mem_region_t;
+
+/* The state of a heap */
+struct mem_heap {
+    char *start_brk;         /* points to first byte of heap */
+    char *brk;               /* points to last byte of heap */
+    char *max_addr;          /* largest legal heap address */
+    char *commit_end;        /* end of the accessible part of the heap */
+    char *reserved;          /* start of the reserved address range */
+    size_t reserved_size;
+    size_t peak;             /* largest heap plus mapped size since the heap was emptied */
+    size_t max_heap;         /* heap limit */
+    int flags;               /* MEM_xxx flags */
+    mem_region_t *regions;   /* regions that are currently mapped */
+    size_t mapped;           /* total size of the mapped regions */
+    size_t peak_resident;    /* largest resident size since mem_reset_resident */
+    unsigned char *pages;    /* page vector for mincore */
+    size_t pages_size;
+};
+
 /* private variables */
-static char *mem_start_brk;  /* points to first byte of heap */
-static char *mem_brk;        /* points to last byte of heap */
-static char *mem_max_addr;   /* largest legal heap address */ 
+static mem_heap_t mem_default = { .max_heap = MAX_HEAP }; /* the heap of mem_init */
+
+static int mem_open(mem_heap_t *h);
+static void mem_update_peak(mem_heap_t *h);
+static size_t mem_round_pages(size_t size);
+static size_t mem_commit_unit(mem_heap_t *h);
+static int mem_commit(mem_heap_t *h, char *end);
+static void mem_release(mem_heap_t *h, char *end);
+static mem_region_t **mem_find_region(mem_heap_t *h, void *addr);
+static void mem_unmap_region(mem_heap_t *h, mem_region_t **link);
+static void mem_unmap_all(mem_heap_t *h);
+static size_t mem_count_resident(mem_heap_t *h, char *lo, size_t size);
+static void mem_sample_resident(mem_heap_t *h);
 
-/* 
+/*
+ * mem_configure - set the heap limit in bytes (0 keeps MAX_HEAP) and the
+ *    MEM_xxx flags for the next mem_init
+ */
+void mem_configure(size_t max_heap, int flags)
+{
+    mem_default.max_heap = (max_heap != 0) ? max_heap : MAX_HEAP;
+    mem_default.flags = flags;
+}
+
+/*
  * mem_init - initialize the memory system model
  */
 void mem_init(void)
 {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-	fprintf(stderr, "mem_init_vm: malloc error\n");
+    if (mem_open(&mem_default) < 0) {
+	fprintf(stderr, "mem_init_vm: mmap error\n");
 	exit(1);
     }
-
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
-    mem_brk = mem_start_brk;                  /* heap is empty initially */
 }
 
-/* 
+/*
  * mem_deinit - free the storage used by the memory system model
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    mem_unmap_all(&mem_default);
+    munmap(mem_default.reserved, mem_default.reserved_size);
+    free(mem_default.pages);
+}
+
+/*
+ * mem_heap_create - make a heap of its own with a limit of max_heap bytes
+ *    (0 for MAX_HEAP) and the given MEM_xxx flags. Returns NULL if there
+ *    is no memory for it.
+ */
+mem_heap_t *mem_heap_create(size_t max_heap, int flags)
+{
+    mem_heap_t *h;
+
+    if ((h = calloc(1, sizeof(mem_heap_t))) == NULL)
+	return NULL;
+
+    h->max_heap = (max_heap != 0) ? max_heap : MAX_HEAP;
+    h->flags = flags;
+    if (mem_open(h) < 0) {
+	free(h);
+	return NULL;
+    }
+    return h;
+}
+
+/*
+ * mem_heap_destroy - free a heap made by mem_heap_create with all of its
+ *    regions
+ */
+void mem_heap_destroy(mem_heap_t *h)
+{
+    mem_unmap_all(h);
+    munmap(h->reserved, h->reserved_size);
+    free(h->pages);
+    free(h);
+}
+
+/*
+ * mem_default_heap - returns the heap that the functions without the _h
+ *    suffix work on
+ */
+mem_heap_t *mem_default_heap(void)
+{
+    return &mem_default;
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_reset_brk - reset the simulated brk pointer to make an empty heap.
+ *    The committed pages stay committed, so the next heap does not fault
+ *    them in again.
  */
 void mem_reset_brk()
 {
-    mem_brk = mem_start_brk;
+    mem_reset_brk_h(&mem_default);
 }
 
-/* 
- * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+void mem_reset_brk_h(mem_heap_t *h)
+{
+    mem_unmap_all(h);
+    h->brk = h->start_brk;
+    h->peak = 0;
+}
+
+/*
+ * mem_sbrk - simple model of the sbrk function. Extends the heap
+ *    by incr bytes and returns the start address of the new area.
+ *    A negative incr shrinks the heap by -incr bytes and returns the
+ *    old end of the heap; the whole pages above the new end are given
+ *    back to the system, but stay committed and read as zeros.
  */
-void *mem_sbrk(int incr) 
+void *mem_sbrk(intptr_t incr)
 {
-    char *old_brk = mem_brk;
+    return mem_sbrk_h(&mem_default, incr);
+}
+
+void *mem_sbrk_h(mem_heap_t *h, intptr_t incr)
+{
+    char *old_brk = h->brk;
+    char *new_brk;
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
+    /* Compare sizes rather than pointers, which must not overflow */
+    if (incr > 0 && (size_t)incr > (size_t)(h->max_addr - h->brk)) {
 	errno = ENOMEM;
 	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 	return (void *)-1;
     }
-    mem_brk += incr;
+    if (incr < 0 && -(size_t)incr > (size_t)(h->brk - h->start_brk)) {
+	errno = EINVAL;
+	fprintf(stderr, "ERROR: mem_sbrk failed. Shrinking below the heap start...\n");
+	return (void *)-1;
+    }
+    new_brk = h->brk + incr;
+    if (new_brk > h->commit_end && mem_commit(h, new_brk) < 0) {
+	errno = ENOMEM;
+	fprintf(stderr, "ERROR: mem_sbrk failed. Cannot commit the heap...\n");
+	return (void *)-1;
+    }
+    if (incr < 0)
+	mem_release(h, new_brk);
+    h->brk = new_brk;
+    mem_update_peak(h);
     return (void *)old_brk;
 }
 
+/*
+ * mem_map - model of an anonymous mmap. Returns a new region of at least
+ *    size bytes, rounded up to whole pages and aligned to a page, that
+ *    lies outside the heap. Returns NULL if there is no memory.
+ */
+void *mem_map(size_t size)
+{
+    return mem_map_h(&mem_default, size);
+}
+
+void *mem_map_h(mem_heap_t *h, size_t size)
+{
+    mem_region_t *r;
+
+    size = mem_round_pages(size);
+    if ((r = malloc(sizeof(mem_region_t))) == NULL)
+	return NULL;
+
+    r->lo = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (r->lo == MAP_FAILED) {
+	free(r);
+	return NULL;
+    }
+    r->size = size;
+    r->next = h->regions;
+    h->regions = r;
+
+    h->mapped += size;
+    mem_update_peak(h);
+    return r->lo;
+}
+
+/*
+ * mem_unmap - gives back a whole region returned by mem_map. Returns 0 on
+ *    success and -1 if addr is not the start of a mapped region.
+ */
+int mem_unmap(void *addr)
+{
+    return mem_unmap_h(&mem_default, addr);
+}
+
+int mem_unmap_h(mem_heap_t *h, void *addr)
+{
+    mem_region_t **link = mem_find_region(h, addr);
+
+    if (link == NULL) {
+	errno = EINVAL;
+	return -1;
+    }
+
+    mem_sample_resident(h);
+    mem_unmap_region(h, link);
+    return 0;
+}
+
+/*
+ * mem_remap - model of mremap. Resizes a region returned by mem_map to
+ *    at least size bytes (rounded up to whole pages). The region may move,
+ *    in which case its contents move with it. Returns the new start of the
+ *    region, or NULL if it cannot be resized (then it is left untouched).
+ */
+void *mem_remap(void *addr, size_t size)
+{
+    return mem_remap_h(&mem_default, addr, size);
+}
+
+void *mem_remap_h(mem_heap_t *h, void *addr, size_t size)
+{
+    mem_region_t **link = mem_find_region(h, addr);
+    mem_region_t *r;
+    char *lo;
+
+    if (link == NULL) {
+	errno = EINVAL;
+	return NULL;
+    }
+
+    r = *link;
+    size = mem_round_pages(size);
+    if (size == r->size)
+	return r->lo;
+
+    mem_sample_resident(h);
+
+#ifdef MREMAP_MAYMOVE
+    lo = mremap(r->lo, r->size, size, MREMAP_MAYMOVE);
+    if (lo == MAP_FAILED)
+	return NULL;
+#else
+    lo = mmap(NULL, size, PROT_READ | PROT_WRITE,
+	      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (lo == MAP_FAILED)
+	return NULL;
+    memcpy(lo, r->lo, (size < r->size) ? size : r->size);
+    munmap(r->lo, r->size);
+#endif
+
+    h->mapped = h->mapped - r->size + size;
+    r->lo = lo;
+    r->size = size;
+    mem_update_peak(h);
+    return lo;
+}
+
+/*
+ * mem_in_mapping - returns 1 if the bytes lo to hi (inclusive) lie within
+ *    a single mapped region, otherwise 0
+ */
+int mem_in_mapping(void *lo, void *hi)
+{
+    return mem_in_mapping_h(&mem_default, lo, hi);
+}
+
+int mem_in_mapping_h(mem_heap_t *h, void *lo, void *hi)
+{
+    mem_region_t *r;
+
+    for (r = h->regions; r != NULL; r = r->next) {
+	if ((char *)lo >= r->lo && (char *)hi < r->lo + r->size)
+	    return 1;
+    }
+    return 0;
+}
+
+/*
+ * mem_mapsize() - returns the total size of the mapped regions in bytes
+ */
+size_t mem_mapsize()
+{
+    return mem_default.mapped;
+}
+
+size_t mem_mapsize_h(mem_heap_t *h)
+{
+    return h->mapped;
+}
+
+/*
+ * mem_open - reserve the address space of a heap whose limit and flags
+ *    are set. Returns 0 on success and -1 on error.
+ */
+static int mem_open(mem_heap_t *h)
+{
+    size_t unit = mem_commit_unit(h);
+
+    /* reserve the address space we will use to model the available VM,
+       with room to align its start to a commit unit */
+    h->reserved_size = (h->max_heap + unit - 1) / unit * unit + unit;
+    h->reserved = mmap(NULL, h->reserved_size, PROT_NONE,
+		       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (h->reserved == MAP_FAILED)
+	return -1;
+
+    h->start_brk = (char *)(((unsigned long)h->reserved + unit - 1) & ~(unit - 1));
+
+#ifdef MADV_HUGEPAGE
+    /* only a hint; the heap works with small pages as well */
+    if (h->flags & MEM_HUGE_PAGES)
+	madvise(h->start_brk, h->reserved_size - unit, MADV_HUGEPAGE);
+#endif
+
+    h->max_addr = h->start_brk + h->max_heap;  /* max legal heap address */
+    h->brk = h->start_brk;                     /* heap is empty initially */
+    h->commit_end = h->start_brk;              /* nothing is committed yet */
+    h->peak = 0;
+    h->regions = NULL;
+    h->mapped = 0;
+    return 0;
+}
+
+/*
+ * mem_update_peak - remember the current footprint if it is the largest
+ */
+static void mem_update_peak(mem_heap_t *h)
+{
+    size_t size = (size_t)(h->brk - h->start_brk) + h->mapped;
+
+    if (size > h->peak)
+	h->peak = size;
+}
+
+/*
+ * mem_round_pages - round a size up to whole pages
+ */
+static size_t mem_round_pages(size_t size)
+{
+    size_t page = mem_pagesize();
+
+    return (size + page - 1) / page * page;
+}
+
+/*
+ * mem_commit_unit - the step in which the heap is committed: a huge page
+ *    with MEM_HUGE_PAGES, otherwise a page
+ */
+static size_t mem_commit_unit(mem_heap_t *h)
+{
+    return (h->flags & MEM_HUGE_PAGES) ? HUGE_PAGE_SIZE : mem_pagesize();
+}
+
+/*
+ * mem_commit - make the heap accessible up to at least end, rounded up to
+ *    a commit unit. Returns 0 on success and -1 on error.
+ */
+static int mem_commit(mem_heap_t *h, char *end)
+{
+    size_t unit = mem_commit_unit(h);
+    char *new_end = (char *)(((unsigned long)end + unit - 1) & ~(unit - 1));
+
+    if (mprotect(h->commit_end, new_end - h->commit_end,
+		 PROT_READ | PROT_WRITE) < 0)
+	return -1;
+
+    h->commit_end = new_end;
+    return 0;
+}
+
+/*
+ * mem_release - give the committed pages that lie wholly above end back
+ *    to the system. They stay committed and read as zeros.
+ */
+static void mem_release(mem_heap_t *h, char *end)
+{
+    char *lo = h->start_brk + mem_round_pages(end - h->start_brk);
+
+    if (lo < h->commit_end) {
+	mem_sample_resident(h);
+	madvise(lo, h->commit_end - lo, MADV_DONTNEED);
+    }
+}
+
+/*
+ * mem_maxheap() - returns the heap limit in bytes
+ */
+size_t mem_maxheap()
+{
+    return mem_default.max_heap;
+}
+
+size_t mem_maxheap_h(mem_heap_t *h)
+{
+    return h->max_heap;
+}
+
+/*
+ * mem_find_region - returns the link that points to the region starting
+ *    at addr, or NULL if there is no such region
+ */
+static mem_region_t **mem_find_region(mem_heap_t *h, void *addr)
+{
+    mem_region_t **link;
+
+    for (link = &h->regions; *link != NULL; link = &(*link)->next) {
+	if ((*link)->lo == (char *)addr)
+	    return link;
+    }
+    return NULL;
+}
+
+/*
+ * mem_unmap_region - give back the region that link points to
+ */
+static void mem_unmap_region(mem_heap_t *h, mem_region_t **link)
+{
+    mem_region_t *r = *link;
+
+    munmap(r->lo, r->size);
+    h->mapped -= r->size;
+    *link = r->next;
+    free(r);
+}
+
+/*
+ * mem_unmap_all - give back every mapped region
+ */
+static void mem_unmap_all(mem_heap_t *h)
+{
+    while (h->regions != NULL)
+	mem_unmap_region(h, &h->regions);
+}
+
+/*
+ * mem_count_resident - returns how many bytes of the page aligned range
+ *    lo to lo + size are resident in memory
+ */
+static size_t mem_count_resident(mem_heap_t *h, char *lo, size_t size)
+{
+    size_t page = mem_pagesize();
+    size_t n = size / page;
+    size_t resident = 0;
+
+    if (n > h->pages_size) {
+	unsigned char *pages = realloc(h->pages, n);
+
+	if (pages == NULL)
+	    return 0;
+	h->pages = pages;
+	h->pages_size = n;
+    }
+
+    if (n == 0 || mincore(lo, size, h->pages) < 0)
+	return 0;
+
+    for (size_t i = 0; i < n; i++)
+	resident += h->pages[i] & 1;
+    return resident * page;
+}
+
+/*
+ * mem_sample_resident - remember the current resident size if it is the
+ *    largest
+ */
+static void mem_sample_resident(mem_heap_t *h)
+{
+    size_t size = mem_resident_h(h);
+
+    if (size > h->peak_resident)
+	h->peak_resident = size;
+}
+
+/*
+ * mem_resident() - returns how many bytes of the heap (including its
+ *    committed part beyond the brk) and of the mapped regions are resident
+ *    in memory
+ */
+size_t mem_resident()
+{
+    return mem_resident_h(&mem_default);
+}
+
+size_t mem_resident_h(mem_heap_t *h)
+{
+    size_t size = mem_count_resident(h, h->start_brk, h->commit_end - h->start_brk);
+    mem_region_t *r;
+
+    for (r = h->regions; r != NULL; r = r->next)
+	size += mem_count_resident(h, r->lo, r->size);
+    return size;
+}
+
+/*
+ * mem_peak_resident() - returns the largest resident size in bytes since
+ *    the last mem_reset_resident
+ */
+size_t mem_peak_resident()
+{
+    return mem_peak_resident_h(&mem_default);
+}
+
+size_t mem_peak_resident_h(mem_heap_t *h)
+{
+    mem_sample_resident(h);
+    return h->peak_resident;
+}
+
+/*
+ * mem_purge - give the pages of the page aligned range lo to lo + size
+ *    of the heap back to the system, like madvise(MADV_DONTNEED). The
+ *    range stays committed and reads as zeros. Returns how many bytes of
+ *    it were resident.
+ */
+size_t mem_purge(void *lo, size_t size)
+{
+    return mem_purge_h(&mem_default, lo, size);
+}
+
+size_t mem_purge_h(mem_heap_t *h, void *lo, size_t size)
+{
+    size_t resident;
+
+    mem_sample_resident(h);
+    resident = mem_count_resident(h, lo, size);
+    if (madvise(lo, size, MADV_DONTNEED) < 0)
+	return 0;
+    return resident;
+}
+
+/*
+ * mem_reset_resident - give the pages of the heap back to the system, so
+ *    that none is resident until it is touched again, and restart the 
+ *    peak. The heap stays committed and reads as zeros.
+ */
+void mem_reset_resident()
+{
+    mem_reset_resident_h(&mem_default);
+}
+
+void mem_reset_resident_h(mem_heap_t *h)
+{
+    madvise(h->start_brk, h->commit_end - h->start_brk, MADV_DONTNEED);
+    h->peak_resident = 0;
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
 void *mem_heap_lo()
 {
-    return (void *)mem_start_brk;
+    return (void *)mem_default.start_brk;
+}
+
+void *mem_heap_lo_h(mem_heap_t *h)
+{
+    return (void *)h->start_brk;
 }
 
-/* 
+/*
  * mem_heap_hi - return address of last heap byte
  */
 void *mem_heap_hi()
 {
-    return (void *)(mem_brk - 1);
+    return (void *)(mem_default.brk - 1);
+}
+
+void *mem_heap_hi_h(mem_heap_t *h)
+{
+    return (void *)(h->brk - 1);
 }
 
 /*
  * mem_heapsize() - returns the heap size in bytes
  */
-size_t mem_heapsize() 
+size_t mem_heapsize()
 {
-    return (size_t)(mem_brk - mem_start_brk);
+    return (size_t)(mem_default.brk - mem_default.start_brk);
+}
+
+size_t mem_heapsize_h(mem_heap_t *h)
+{
+    return (size_t)(h->brk - h->start_brk);
+}
+
+/*
+ * mem_peak_heapsize() - returns the largest footprint in bytes (the heap
+ *    plus the mapped regions) since the heap was last emptied
+ */
+size_t mem_peak_heapsize()
+{
+    return mem_default.peak;
+}
+
+size_t mem_peak_heapsize_h(mem_heap_t *h)
+{
+    return h->peak;
 }
 
 /*
@@ -99,3 +666,18 @@ size_t mem_pagesize()
 {
     return (size_t)getpagesize();
 }
+
+/*
+ * mem_commitsize() - returns the step in bytes in which the heap is 
+ *    committed, so a touched heap may be resident up to the next multiple
+ *    of it: a huge page with MEM_HUGE_PAGES, otherwise a page
+ */
+size_t mem_commitsize()
+{
+    return mem_commit_unit(&mem_default);
+}
+
+size_t mem_commitsize_h(mem_heap_t *h)
+{
+    return mem_commit_unit(h);
+}
@@ -1,11 +1,52 @@
+#include <stdint.h>
 #include <unistd.h>
 
-void mem_init(void);               
+/* Flags of mem_configure and mem_heap_create */
+#define MEM_HUGE_PAGES 1   /* back the heap with transparent huge pages */
+
+/* The state of one simulated heap (see memlib.c) */
+typedef struct mem_heap mem_heap_t;
+
+void mem_configure(size_t max_heap, int flags);
+void mem_init(void);
 void mem_deinit(void);
-void *mem_sbrk(int incr);
-void mem_reset_brk(void); 
+void *mem_sbrk(intptr_t incr);
+void *mem_map(size_t size);
+int mem_unmap(void *addr);
+void *mem_remap(void *addr, size_t size);
+int mem_in_mapping(void *lo, void *hi);
+void mem_reset_brk(void);
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
+size_t mem_peak_heapsize(void);
+size_t mem_mapsize(void);
+size_t mem_maxheap(void);
 size_t mem_pagesize(void);
+size_t mem_commitsize(void);
+size_t mem_resident(void);
+size_t mem_peak_resident(void);
+void mem_reset_resident(void);
+size_t mem_purge(void *lo, size_t size);
 
+/* Heaps of their own, and the same functions for a given heap */
+mem_heap_t *mem_heap_create(size_t max_heap, int flags);
+void mem_heap_destroy(mem_heap_t *h);
+mem_heap_t *mem_default_heap(void);
+void *mem_sbrk_h(mem_heap_t *h, intptr_t incr);
+void *mem_map_h(mem_heap_t *h, size_t size);
+int mem_unmap_h(mem_heap_t *h, void *addr);
+void *mem_remap_h(mem_heap_t *h, void *addr, size_t size);
+int mem_in_mapping_h(mem_heap_t *h, void *lo, void *hi);
+void mem_reset_brk_h(mem_heap_t *h);
+void *mem_heap_lo_h(mem_heap_t *h);
+void *mem_heap_hi_h(mem_heap_t *h);
+size_t mem_heapsize_h(mem_heap_t *h);
+size_t mem_peak_heapsize_h(mem_heap_t *h);
+size_t mem_mapsize_h(mem_heap_t *h);
+size_t mem_maxheap_h(mem_heap_t *h);
+size_t mem_commitsize_h(mem_heap_t *h);
+size_t mem_resident_h(mem_heap_t *h);
+size_t mem_peak_resident_h(mem_heap_t *h);
+void mem_reset_resident_h(mem_heap_t *h);
+size_t mem_purge_h(mem_heap_t *h, void *lo, size_t size);
@@ -0,0 +1,177 @@
+/*
+ * mm-arena.c - Region allocator on top of the mm.h interface.
+ *
+ * A region (mm_arena_t) hands out objects by bumping a pointer through
+ * chunks that it takes from mm_malloc. The objects are never freed one by
+ * one. mm_arena_reset gives all chunks but the first back with a single
+ * mm_free_batch call, and the first chunk is bumped through again. This
+ * suits objects that live exactly as long as one request.
+ *
+ * Requests larger than half a chunk get a chunk of their own, so a large
+ * object does not waste the rest of the current chunk.
+ *
+ * Only the public interface of the engine is used, so the regions work
+ * with mm.c and mm-tlsf.c alike.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "mm.h"
+#include "config.h"
+
+#define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~(ALIGNMENT-1))
+
+#define ARENA_CHUNK_SIZE (32*(1<<10)) /* Default size of a chunk */
+#define ARENA_MIN_CHUNKS 8 /* Initial room in the chunk array */
+
+struct mm_arena {
+    void **chunks;     /* Every chunk taken from mm_malloc, the first one is kept by a reset */
+    int num_chunks;
+    int max_chunks;
+    char *ptr;         /* Next free byte of the current chunk */
+    char *end;         /* End of the current chunk */
+    size_t chunk_size;
+    size_t first_size; /* Size of the first chunk, which may be a large object */
+};
+
+static void *add_chunk(mm_arena_t *, size_t);
+
+/*
+ * Creates a region
+ *
+ * Input:
+ * chunk_size - The size of the chunks taken from mm_malloc (0 selects the default)
+ *
+ * Returns:
+ * The region, or NULL if the heap is full
+ */
+mm_arena_t *mm_arena_create(size_t chunk_size) {
+
+    mm_arena_t *arena = mm_malloc(sizeof(mm_arena_t));
+
+    if(arena == NULL)
+        return NULL;
+
+    arena->chunks = mm_malloc(ARENA_MIN_CHUNKS * sizeof(void *));
+    if(arena->chunks == NULL) {
+        mm_free(arena);
+        return NULL;
+    }
+
+    arena->num_chunks = 0;
+    arena->max_chunks = ARENA_MIN_CHUNKS;
+    arena->ptr = NULL;
+    arena->end = NULL;
+    arena->first_size = 0;
+    arena->chunk_size = (chunk_size != 0) ? ALIGN(chunk_size) : ARENA_CHUNK_SIZE;
+
+    return arena;
+}
+
+/*
+ * Allocates an object in a region by bumping the pointer of the current
+ * chunk. A new chunk is taken if the object does not fit.
+ *
+ * Inputs:
+ * arena - The region
+ * size - The requested size
+ *
+ * Returns:
+ * The pointer to the object, or NULL if the size is 0 or too large, or if
+ * the heap is full
+ */
+void *mm_arena_alloc(mm_arena_t *arena, size_t size) {
+
+    // Like mm_malloc, ignore spurious requests, and sizes that would wrap when aligned
+    if(size == 0 || size > SIZE_MAX - (ALIGNMENT-1))
+        return NULL;
+
+    size = ALIGN(size);
+
+    if(size <= (size_t)(arena->end - arena->ptr)) {
+        void *bp = arena->ptr;
+
+        arena->ptr += size;
+        return bp;
+    }
+
+    // A large object gets a chunk of its own and the current chunk stays
+    if(size > arena->chunk_size / 2)
+        return add_chunk(arena, size);
+
+    char *chunk = add_chunk(arena, arena->chunk_size);
+    if(chunk == NULL)
+        return NULL;
+
+    arena->ptr = chunk + size;
+    arena->end = chunk + arena->chunk_size;
+
+    return chunk;
+}
+
+/*
+ * Frees every object of a region at once. The first chunk is kept for the
+ * next objects, and the others go back to the heap in one mm_free_batch.
+ *
+ * Input:
+ * arena - The region
+ */
+void mm_arena_reset(mm_arena_t *arena) {
+
+    if(arena->num_chunks == 0)
+        return;
+
+    mm_free_batch(arena->chunks + 1, arena->num_chunks - 1);
+    arena->num_chunks = 1;
+
+    // Even a chunk of a large object is bumped through after the reset
+    arena->ptr = arena->chunks[0];
+    arena->end = arena->ptr + arena->first_size;
+}
+
+/*
+ * Frees a region together with all of its objects
+ *
+ * Input:
+ * arena - The region
+ */
+void mm_arena_destroy(mm_arena_t *arena) {
+
+    mm_free_batch(arena->chunks, arena->num_chunks);
+    mm_free(arena->chunks);
+    mm_free(arena);
+}
+
+/*
+ * Takes a chunk from mm_malloc and records it in the region
+ *
+ * Inputs:
+ * arena - The region
+ * size - The size of the chunk
+ *
+ * Returns:
+ * The chunk, or NULL if the heap is full
+ */
+static void *add_chunk(mm_arena_t *arena, size_t size) {
+
+    if(arena->num_chunks == arena->max_chunks) {
+        void **chunks = mm_realloc(arena->chunks, 2 * arena->max_chunks * sizeof(void *));
+
+        if(chunks == NULL)
+            return NULL;
+
+        arena->chunks = chunks;
+        arena->max_chunks *= 2;
+    }
+
+    void *chunk = mm_malloc(size);
+    if(chunk == NULL)
+        return NULL;
+
+    if(arena->num_chunks == 0)
+        arena->first_size = size;
+    arena->chunks[arena->num_chunks++] = chunk;
+
+    return chunk;
+}
@@ -0,0 +1,740 @@
+/*
+ * mm-tlsf.c - Two-level segregated fit (TLSF) allocator.
+ *
+ * This is an alternative engine to the segregated free lists in mm.c. It
+ * implements the same interface (mm.h) so the driver can be linked against
+ * either of them (see the mdriver-tlsf target in the Makefile).
+ *
+ * The free blocks are kept in a matrix of free lists. The first level splits
+ * the sizes into powers of two, and the second level splits every power of
+ * two into SL_COUNT lists of equal width. A bitmap for each level records
+ * which lists are non-empty, so finding a list with a block that fits is a
+ * couple of bit scans no matter how many free blocks there are. Both
+ * mm_malloc and mm_free therefore run in constant time (apart from
+ * extending the heap).
+ *
+ * The blocks keep the boundary tags of the original mm.c, with a footer on
+ * allocated blocks as well (mm.c has since replaced that footer by a 
+ * prev-allocated bit in the header):
+ *
+ * Allocated block:
+ * <HEADER>           - This consist of the size and an allocation status flag
+ * <PAYLOAD>          - The blocks that can contain data from the user of the allocator
+ * <FOOTER>           - This consist of the size and an allocation status flag
+ *
+ * Free block:
+ * <HEADER>           - This consist of the size and an allocation status flag
+ * <PREVIOUS OFFSET>  - The offset of the previous free block from the heap start
+ * <NEXT OFFSET>      - The offset of the next free block from the heap start
+ * <PAYLOAD>          - The blocks that can contain data from the user of the allocator
+ * <FOOTER>           - This consist of the size and an allocation status flag
+ *
+ * When searching, the requested size is rounded up to the next list
+ * boundary. Every block of the list found is then guaranteed to fit, so the
+ * head of the list is used without scanning it (a "good fit").
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <unistd.h>
+#include <string.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "config.h"
+
+team_t team = {
+    /* Team name */
+    "anti",
+    /* First member's full name */
+    "Andreas Nicolaj Tietgen",
+    /* First member's email address */
+    "anti@itu.dk",
+    /* Second member's full name (leave blank if none) */
+    "",
+    /* Second member's email address (leave blank if none) */
+    ""
+};
+
+/* ALIGNMENT (8 or 16 bytes) comes from config.h */
+
+/* rounds up to the nearest multiple of ALIGNMENT */
+#define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~(ALIGNMENT-1))
+
+/* Basic constants and macros */
+#define WSIZE 4 /* Word and header/footer size (bytes) */
+#define DSIZE 8 /* Double word size (bytes) */
+#define CHUNKSIZE (1<<12) /* Extend heap by this amount (bytes) */
+#define MIN_BLOCK_SIZE (2*DSIZE) /* Header, two free list pointers and footer */
+#define MAX_BLOCK_SIZE 0xfffffff8U /* Largest size a header word holds */
+
+#define MAX(x, y) ((x) > (y)? (x) : (y))
+
+/* Pack a size and allocated bit into a word */
+#define PACK(size, alloc) ((size) | (alloc))
+
+/* Read and write a word at address p */
+#define GET(p) (*(unsigned int *)(p))
+#define PUT(p, val) (*(unsigned int *)(p) = (val))
+
+/* Set the NEXT or PREV block pointer, stored as an offset from the heap start */
+#define SET_FREE_P(p, np) (*(unsigned int *)(p) = heap_offset(np))
+
+/* Read the size and allocated fields from address p */
+#define GET_SIZE(p) (GET(p) & ~0x7)
+#define GET_ALLOC(p) (GET(p) & 0x1)
+
+/* Given block ptr bp, compute address of its header and footer */
+#define HDRP(bp) ((char *)(bp) - (WSIZE))
+#define FTRP(bp) ((char *)(bp) + GET_SIZE(HDRP(bp)) - (DSIZE))
+
+/* Get the pointer to the NEXT and PREV fields */
+#define NEXT_FRBP(bp) ((char *)(bp) + WSIZE)
+#define PREV_FRBP(bp) ((char *)(bp))
+
+/* Get the NEXT or PREV free block */
+#define NEXT_FREE_BLOCK(bp) (GET(NEXT_FRBP(bp)) ? heap_base + GET(NEXT_FRBP(bp)) : NULL)
+#define PREV_FREE_BLOCK(bp) (GET(PREV_FRBP(bp)) ? heap_base + GET(PREV_FRBP(bp)) : NULL)
+
+/* Given block ptr bp, compute address of next and previous blocks */
+#define NEXT_BLKP(bp) ((char *)(bp) + GET_SIZE(((char *)(bp) - (WSIZE))))
+#define PREV_BLKP(bp) ((char *)(bp) - GET_SIZE(((char *)(bp) - (DSIZE))))
+
+/* TLSF parameters */
+#define SL_COUNT_LOG2 4 /* log2 of the number of second level lists */
+#define SL_COUNT (1 << SL_COUNT_LOG2)
+#define ALIGN_LOG2 (ALIGNMENT == 16 ? 4 : 3) /* log2 of ALIGNMENT */
+#define FL_SHIFT (SL_COUNT_LOG2 + ALIGN_LOG2) /* Sizes below 2^FL_SHIFT share the first list */
+#define FL_MAX 31 /* Largest power of two that can be managed, enough for any 32-bit block size */
+#define FL_COUNT (FL_MAX - FL_SHIFT + 2)
+#define SMALL_BLOCK_SIZE (1 << FL_SHIFT)
+
+// Global variables
+static char *heap_listp;
+static char *heap_base; /* The free list links are offsets from here */
+static unsigned int fl_map; /* Bit i is set when first level i has a non-empty list */
+static unsigned int sl_map[FL_COUNT]; /* Bit j is set when blocks[i][j] is non-empty */
+static char *blocks[FL_COUNT][SL_COUNT];
+static mm_stats_t stats; /* Counters reported by mm_get_stats */
+
+/*
+ * Converts a free block pointer to its offset from the start of the heap
+ *
+ * Input:
+ * bp - The block pointer or NULL
+ *
+ * Returns:
+ * The offset of the block or 0 for NULL
+*/
+static inline unsigned int heap_offset(void *bp) {
+
+    return (bp != NULL) ? (unsigned int)((char *)bp - heap_base) : 0;
+}
+
+
+/* Function definitions */
+
+static void mapping_insert(size_t, int *, int *);
+static void mapping_search(size_t, int *, int *);
+static void *find_suitable_block(int *, int *);
+static void insert_free_block(void *);
+static void remove_free_block(void *);
+static void *coalesce(void *);
+static void *extend_heap(size_t);
+static void *place(void *, size_t);
+
+
+/*
+ * Finds the index of the most significant set bit
+ *
+ * Input:
+ * word - A non-zero word
+ *
+ * Returns:
+ * The index of the highest set bit
+*/
+static int fls(size_t word) {
+
+    return 63 - __builtin_clzll(word);
+}
+
+/*
+ * Computes the first and second level indexes of the list that a free block
+ * of the given size belongs to
+ *
+ * Inputs:
+ * size - The size of the free block
+ * fli - Set to the first level index
+ * sli - Set to the second level index
+*/
+static void mapping_insert(size_t size, int *fli, int *sli) {
+
+    if(size < SMALL_BLOCK_SIZE) {
+
+        // Small sizes are spread linearly over the first lists
+        *fli = 0;
+        *sli = size / (SMALL_BLOCK_SIZE / SL_COUNT);
+    } else {
+        int fl = fls(size);
+
+        *sli = (size >> (fl - SL_COUNT_LOG2)) ^ (1 << SL_COUNT_LOG2);
+        *fli = fl - (FL_SHIFT - 1);
+    }
+}
+
+/*
+ * Computes the indexes of the first list where every block is at least of
+ * the given size. The size is rounded up to the next list boundary.
+ *
+ * Inputs:
+ * size - The requested block size
+ * fli - Set to the first level index
+ * sli - Set to the second level index
+*/
+static void mapping_search(size_t size, int *fli, int *sli) {
+
+    if(size >= SMALL_BLOCK_SIZE)
+        size += (1 << (fls(size) - SL_COUNT_LOG2)) - 1;
+
+    mapping_insert(size, fli, sli);
+}
+
+/*
+ * Finds a non-empty list at or above the given indexes using the bitmaps
+ *
+ * Inputs:
+ * fli - The first level index to start from. Updated to the list found
+ * sli - The second level index to start from. Updated to the list found
+ *
+ * Returns:
+ * The first block of the list found or NULL if there is no such list
+*/
+static void *find_suitable_block(int *fli, int *sli) {
+
+    int fl = *fli;
+
+    if(fl >= FL_COUNT)
+        return NULL;
+
+    // Search the second level of the current first level
+    unsigned int sl_bits = sl_map[fl] & (~0U << *sli);
+
+    if(sl_bits == 0) {
+
+        // Nothing there, so go to the next non-empty first level
+        unsigned int fl_bits = (fl + 1 < 32) ? fl_map & (~0U << (fl + 1)) : 0;
+
+        if(fl_bits == 0)
+            return NULL;
+
+        fl = __builtin_ctz(fl_bits);
+        sl_bits = sl_map[fl];
+    }
+
+    *fli = fl;
+    *sli = __builtin_ctz(sl_bits);
+
+    return blocks[fl][*sli];
+}
+
+/*
+ * Inserts the free block at the head of its list and marks it in the bitmaps
+ *
+ * Input:
+ * bp - The free block to be inserted
+*/
+static void insert_free_block(void *bp) {
+
+    int fl, sl;
+    mapping_insert(GET_SIZE(HDRP(bp)), &fl, &sl);
+    assert(fl < FL_COUNT);
+
+    char *head = blocks[fl][sl];
+
+    SET_FREE_P(PREV_FRBP(bp), NULL);
+    SET_FREE_P(NEXT_FRBP(bp), head);
+
+    if(head != NULL)
+        SET_FREE_P(PREV_FRBP(head), bp);
+
+    blocks[fl][sl] = bp;
+    fl_map |= 1U << fl;
+    sl_map[fl] |= 1U << sl;
+}
+
+/*
+ * Removes the block from its list and clears the bitmaps if the list
+ * became empty
+ *
+ * Input:
+ * bp - The free block to be removed from the free list
+*/
+static void remove_free_block(void *bp) {
+
+    int fl, sl;
+    mapping_insert(GET_SIZE(HDRP(bp)), &fl, &sl);
+    assert(fl < FL_COUNT);
+
+    char *next = NEXT_FREE_BLOCK(bp);
+    char *prev = PREV_FREE_BLOCK(bp);
+
+    if(next != NULL)
+        SET_FREE_P(PREV_FRBP(next), prev);
+
+    if(prev != NULL)
+        SET_FREE_P(NEXT_FRBP(prev), next);
+    else {
+        blocks[fl][sl] = next;
+
+        if(next == NULL) {
+            sl_map[fl] &= ~(1U << sl);
+
+            if(sl_map[fl] == 0)
+                fl_map &= ~(1U << fl);
+        }
+    }
+}
+
+/*
+ * Coalesces the free block with its free neighbours. The neighbours are
+ * removed from their lists but the resulting block is not inserted.
+ *
+ * Input:
+ * The block pointer to coalesce
+ *
+ * Returns:
+ * A pointer to the coalesced block
+*/
+static void *coalesce(void *bp) {
+
+    size_t size = GET_SIZE(HDRP(bp));
+
+    // Merge with the right neighbour
+    if(!GET_ALLOC(HDRP(NEXT_BLKP(bp)))) {
+
+        remove_free_block(NEXT_BLKP(bp));
+        size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
+        PUT(HDRP(bp), PACK(size, 0));
+        PUT(FTRP(bp), PACK(size, 0));
+    }
+
+    // Merge with the left neighbour
+    if(!GET_ALLOC(HDRP(bp) - WSIZE)) {
+
+        bp = PREV_BLKP(bp);
+        remove_free_block(bp);
+        size += GET_SIZE(HDRP(bp));
+        PUT(HDRP(bp), PACK(size, 0));
+        PUT(FTRP(bp), PACK(size, 0));
+    }
+
+    return bp;
+}
+
+/*
+ * Extends the heap with a free block of at least the given size. The block
+ * is coalesced with a free block at the end of the heap, but it is not
+ * inserted into a free list.
+ *
+ * Input:
+ * size - The number of bytes to extend the heap with
+ *
+ * Returns:
+ * Pointer to the new free block of memory or NULL if the heap is full
+*/
+static void *extend_heap(size_t size) {
+
+    char *bp;
+
+    if((long)(bp = mem_sbrk(size)) == -1)
+        return NULL;
+
+    /* Initialize free block header/footer and the epilogue header */
+    PUT(HDRP(bp), PACK(size, 0));
+    PUT(FTRP(bp), PACK(size, 0));
+    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1));
+
+    return coalesce(bp);
+}
+
+/*
+ * Marks the block (which is not in a free list) as allocated and splits off
+ * the remainder if it is large enough to be a free block of its own.
+ *
+ * Inputs:
+ * bp - The free block to allocate
+ * asize - The adjusted size to allocate
+ *
+ * Returns:
+ * The allocated block
+*/
+static void *place(void *bp, size_t asize) {
+
+    size_t size = GET_SIZE(HDRP(bp));
+
+    if(size - asize >= MIN_BLOCK_SIZE) {
+
+        PUT(HDRP(bp), PACK(asize, 1));
+        PUT(FTRP(bp), PACK(asize, 1));
+
+        void *split_p = NEXT_BLKP(bp);
+        PUT(HDRP(split_p), PACK(size - asize, 0));
+        PUT(FTRP(split_p), PACK(size - asize, 0));
+        insert_free_block(split_p);
+    } else {
+        PUT(HDRP(bp), PACK(size, 1));
+        PUT(FTRP(bp), PACK(size, 1));
+    }
+
+    return bp;
+}
+
+/*
+ * mm_init - initialize the malloc package.
+ */
+int mm_init(void) {
+
+    /* Create the initial empty heap */
+    heap_base = mem_heap_lo();
+    if((heap_listp = mem_sbrk(4*WSIZE)) == (void *)-1)
+        return -1;
+
+    fl_map = 0;
+    memset(&stats, 0, sizeof(stats));
+    for(int i = 0; i < FL_COUNT; i++) {
+        sl_map[i] = 0;
+
+        for(int j = 0; j < SL_COUNT; j++)
+            blocks[i][j] = NULL;
+    }
+
+    PUT(heap_listp, 0); /* Alignment padding */
+    PUT(heap_listp + (1*WSIZE), PACK(DSIZE, 1)); /* Prologue header */
+    PUT(heap_listp + (2*WSIZE), PACK(DSIZE, 1)); /* Prologue footer */
+    PUT(heap_listp + (3*WSIZE), PACK(0, 1)); /* Epilogue header */
+    heap_listp += DSIZE;
+
+    void *bp = extend_heap(CHUNKSIZE);
+    if(bp == NULL)
+        return -1;
+
+    insert_free_block(bp);
+    return 0;
+}
+
+/*
+ * Allocates a block of memory with the requested size.
+ *
+ * Input:
+ * size - The size that should be allocated
+ *
+ * Returns:
+ * The pointer to the allocated block of memory.
+ * If it is not able to allocate more memory then it returns NULL
+ */
+void *mm_malloc(size_t size) {
+
+    size_t asize;
+    int fl, sl;
+    char *bp;
+
+    /* Ignore spurious requests and those that no header can describe */
+    if(size == 0 || size > MAX_BLOCK_SIZE - DSIZE)
+        return NULL;
+
+    /* Adjust block size to include overhead and alignment reqs. */
+    asize = (size <= DSIZE) ? MIN_BLOCK_SIZE : ALIGN(size + DSIZE);
+
+    mapping_search(asize, &fl, &sl);
+
+    if((bp = find_suitable_block(&fl, &sl)) != NULL) {
+        remove_free_block(bp);
+        return place(bp, asize);
+    }
+
+    /* No list can serve the request. Get more memory and place the block */
+    if((bp = extend_heap(MAX(asize, CHUNKSIZE))) == NULL)
+        return NULL;
+
+    return place(bp, asize);
+}
+
+/*
+ * Allocates a block whose payload is aligned to the given alignment. A
+ * block with room for any position of the payload is allocated, and the 
+ * gap in front of the payload and the rest behind it are freed again.
+ *
+ * Inputs:
+ * alignment - The alignment of the payload. Must be a power of two
+ * size - The requested size
+ *
+ * Returns:
+ * The pointer to the aligned payload, or NULL if the alignment is not a 
+ * power of two or the heap is full
+ */
+void *mm_memalign(size_t alignment, size_t size) {
+
+    if(size == 0 || alignment == 0 || (alignment & (alignment - 1)) != 0)
+        return NULL;
+
+    if(alignment <= ALIGNMENT)
+        return mm_malloc(size);
+
+    char *bp = mm_malloc(size + alignment + MIN_BLOCK_SIZE);
+    if(bp == NULL)
+        return NULL;
+
+    // The gap must be large enough to be a free block of its own
+    char *aligned_bp = bp + (-(unsigned long)bp & (alignment - 1));
+    while(aligned_bp != bp && aligned_bp - bp < MIN_BLOCK_SIZE)
+        aligned_bp += alignment;
+
+    size_t total = GET_SIZE(HDRP(bp));
+
+    if(aligned_bp != bp) {
+        size_t gap = aligned_bp - bp;
+
+        total -= gap;
+        PUT(HDRP(aligned_bp), PACK(total, 1));
+        PUT(FTRP(aligned_bp), PACK(total, 1));
+        PUT(HDRP(bp), PACK(gap, 1));
+        PUT(FTRP(bp), PACK(gap, 1));
+        mm_free(bp);
+    }
+
+    size_t asize = (size <= DSIZE) ? MIN_BLOCK_SIZE : ALIGN(size + DSIZE);
+
+    if(total - asize >= MIN_BLOCK_SIZE) {
+        PUT(HDRP(aligned_bp), PACK(asize, 1));
+        PUT(FTRP(aligned_bp), PACK(asize, 1));
+
+        char *rest = NEXT_BLKP(aligned_bp);
+        PUT(HDRP(rest), PACK(total - asize, 1));
+        PUT(FTRP(rest), PACK(total - asize, 1));
+        mm_free(rest);
+    }
+
+    return aligned_bp;
+}
+
+/*
+ * Frees the block of memory and inserts it into the free lists after
+ * coalescing it with its neighbours.
+ *
+ * Input:
+ * bp - the block of memory to be free'ed
+ */
+void mm_free(void *bp) {
+
+    if(bp == NULL)
+        return;
+
+    size_t size = GET_SIZE(HDRP(bp));
+    PUT(HDRP(bp), PACK(size, 0));
+    PUT(FTRP(bp), PACK(size, 0));
+
+    insert_free_block(coalesce(bp));
+}
+
+/*
+ * Frees a block of a known size. TLSF needs the header to coalesce the
+ * block anyway, so the size is ignored.
+ *
+ * Inputs:
+ * bp - the block of memory to be free'ed
+ * size - the size it was allocated with
+ */
+void mm_free_sized(void *bp, size_t size) {
+
+    (void)size;
+    mm_free(bp);
+}
+
+/*
+ * Allocates n objects of the same size. TLSF finds a block in constant
+ * time, so the objects are simply allocated one by one.
+ *
+ * Inputs:
+ * size - The requested size of every object
+ * n - The number of objects
+ * out - The array that receives the pointers
+ *
+ * Returns:
+ * The number of objects allocated
+ */
+int mm_malloc_batch(size_t size, int n, void **out) {
+
+    int count = 0;
+
+    while(count < n && (out[count] = mm_malloc(size)) != NULL)
+        count++;
+
+    return count;
+}
+
+/*
+ * Frees n blocks one by one, since every free coalesces right away
+ *
+ * Inputs:
+ * ptrs - The blocks to free
+ * n - The number of blocks
+ */
+void mm_free_batch(void **ptrs, int n) {
+
+    for(int i = 0; i < n; i++)
+        mm_free(ptrs[i]);
+}
+
+/*
+ * Extends the current allocated block into a free right neighbour if
+ * possible or if the size is below the current allocated size then it does
+ * nothing. If it is not possible then it reallocates the block of memory.
+ *
+ * Inputs:
+ * ptr - The pointer to the block of memory that needs to be allocated
+ * size - The new size that it needs to be allocated to
+ *
+ * Returns:
+ * The pointer to the reallocated block of memory
+ */
+void *mm_realloc(void *ptr, size_t size) {
+
+    if(ptr == NULL)
+        return mm_malloc(size);
+
+    if(size == 0) {
+        mm_free(ptr);
+        return NULL;
+    }
+
+    size_t asize = (size <= DSIZE) ? MIN_BLOCK_SIZE : ALIGN(size + DSIZE);
+    size_t old_size = GET_SIZE(HDRP(ptr));
+
+    stats.reallocs++;
+
+    if(old_size >= asize)
+        return ptr;
+
+    // Absorb a free right neighbour if that makes the block big enough
+    void *next = NEXT_BLKP(ptr);
+    size_t total = old_size + GET_SIZE(HDRP(next));
+
+    if(!GET_ALLOC(HDRP(next)) && total >= asize) {
+
+        remove_free_block(next);
+        PUT(HDRP(ptr), PACK(total, 1));
+        PUT(FTRP(ptr), PACK(total, 1));
+        return ptr;
+    }
+
+    void *newptr = mm_malloc(size);
+    if(newptr == NULL)
+        return NULL;
+
+    memcpy(newptr, ptr, old_size - DSIZE);
+    mm_free(ptr);
+    stats.realloc_moves++;
+    stats.bytes_copied += old_size - DSIZE;
+    return newptr;
+}
+
+/*
+ * TLSF keeps its state in globals and works on the default heap only, so
+ * no context can be created
+ *
+ * Input:
+ * heap - The memlib heap of the context
+ *
+ * Returns:
+ * NULL
+ */
+mm_context_t *mm_context_create(struct mem_heap *heap) {
+
+    (void)heap;
+    return NULL;
+}
+
+/*
+ * There are no contexts to free
+ *
+ * Input:
+ * c - The context
+ */
+void mm_context_destroy(mm_context_t *c) {
+
+    (void)c;
+}
+
+/*
+ * Only the default context exists, so there is nothing to select
+ *
+ * Input:
+ * c - The context, NULL for the default one
+ *
+ * Returns:
+ * NULL, the default context
+ */
+mm_context_t *mm_set_context(mm_context_t *c) {
+
+    (void)c;
+    return NULL;
+}
+
+/*
+ * TLSF always takes the head of the first list whose blocks all fit, so
+ * its fit policy is fixed and the selection is ignored.
+ *
+ * Inputs:
+ * policy - The requested fit policy
+ * probes - The probe bound of MM_FIT_GOOD
+ */
+void mm_set_fit_policy(mm_fit_policy_t policy, int probes) {
+
+    (void)policy;
+    (void)probes;
+}
+
+/*
+ * TLSF never gives memory back to memlib, so the threshold is ignored
+ *
+ * Input:
+ * threshold - The requested trim threshold
+ */
+void mm_set_trim_threshold(size_t threshold) {
+
+    (void)threshold;
+}
+
+/*
+ * TLSF takes every block from the heap, so the threshold is ignored
+ *
+ * Input:
+ * threshold - The requested mmap threshold
+ */
+void mm_set_mmap_threshold(size_t threshold) {
+
+    (void)threshold;
+}
+
+/*
+ * TLSF never purges the pages of its free blocks, so the decay is ignored
+ *
+ * Input:
+ * decay - The requested purge decay
+ */
+void mm_set_purge_decay(unsigned int decay) {
+
+    (void)decay;
+}
+
+/*
+ * Gets the counters since the last mm_init. TLSF has no quick lists, so 
+ * only the realloc counters are non-zero
+ *
+ * Input:
+ * s - Where the counters are stored
+ */
+void mm_get_stats(mm_stats_t *s) {
+
+    *s = stats;
+}
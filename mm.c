@@ -14,9 +14,14 @@
 #include <assert.h>
 #include <unistd.h>
 #include <string.h>
+#include <stdint.h>
+#ifdef MM_THREADS
+#include <pthread.h>
+#endif
 
 #include "mm.h"
 #include "memlib.h"
+#include "config.h"
 
 /*
  * The implementation of the dynamic memory allocator uses a segregated free list
@@ -27,12 +32,13 @@
  * They are different in terms of what data is being expected to be present in them.
  * 
  * Allocated block:
- * <HEADER>           - This consist of the size and an allocation status flag
+ * <HEADER>           - This consist of the size, an allocation status flag and a
+ *                      flag telling if the previous block is allocated
  * <PAYLOAD>          - The blocks that can contain data from the user of the allocator
- * <FOOTER>           - This consist of the size and an allocation status flag
  * 
  * Free block:
- * <HEADER>           - This consist of the size and an allocation status flag
+ * <HEADER>           - This consist of the size, an allocation status flag and a
+ *                      flag telling if the previous block is allocated
  * <PREVIOUS POINTER> - A pointer to the previous free block
  * <NEXT POINTER>     - A pointer to the next free block
  * <PAYLOAD>          - The blocks that can contain data from the user of the allocator
@@ -40,14 +46,104 @@
  *  
  * The next and previous pointers are gone one a block is allocated. 
  * The next and previous pointers points to the first byte of the payload.
+ * They are stored as 32-bit offsets from the start of the heap rather than
+ * as addresses, so a free block needs 16 bytes on 64-bit hosts as well.
+ * 
+ * The footer is only needed by 'coalesce' to find the start of a free left
+ * neighbour, so allocated blocks do not have one. Instead every header 
+ * records whether the previous block is allocated, which means the only
+ * overhead of an allocated block is its header.
+ * 
+ * The allocator has 28 size classes. Blocks up to 128 bytes get an exact 
+ * class per 8 bytes, and every power of two up to 1024 bytes is split into
+ * 4 classes (Rules for finding the specific list index based on size can be
+ * found in the 'get_free_list_index' function). Each of these classes is a
+ * free list. 
+ * 
+ * The last class holds every free block above 1024 bytes, which can be many
+ * blocks of very different sizes. It is not a list but a treap (a binary 
+ * search tree that is balanced by random priorities) ordered by size and 
+ * then address. The priority of a node is a hash of its address, so a node 
+ * only needs its two child pointers, which are stored where the list 
+ * pointers of the other free blocks are. Insert, remove and finding the 
+ * smallest block that fits all take O(log n) expected time.
+ * 
+ * A bitmap keeps track of which free lists are non-empty. When the allocator 
+ * wants to find a free block then it searches the list of the size class for 
+ * the first block that "fits". If that is not possible then the next non-empty
+ * list is found with a single bit scan, and its first block always fits.
+ * 
+ * That is the default first fit policy, and mm_set_fit_policy selects
+ * another one. The other policies turn size classes into treaps like the 
+ * one of the large blocks, so that the block they want is still found in
+ * O(log n):
+ * - Best fit makes a treap of every class that holds more than one size. 
+ *   It takes the smallest block that fits in the class of the request, and
+ *   otherwise the smallest block of the next non-empty class.
+ * - Address-ordered first fit makes a treap ordered by address of every 
+ *   class, the large blocks included. Above the exact classes a node also
+ *   records the largest block of its subtree, which leads the search to the
+ *   lowest block that fits. That is compared with the lowest blocks of all 
+ *   of the larger non-empty classes.
+ * - Good fit keeps the lists LIFO but looks at no more than 'good_fit_probes'
+ *   blocks of the size class and takes the smallest of those that fit. In 
+ *   the tree of large blocks it goes down no more than that many nodes from
+ *   the first block that fits.
+ * Under first fit and best fit the tree of large blocks gives the smallest
+ * block that fits.
+ * 
+ * Freed blocks of at most QUICK_MAX_SIZE bytes are not coalesced right away.
+ * They stay marked as allocated and are pushed on a quick list of their 
+ * exact size, from which the next malloc of that size takes them without 
+ * any search, split or coalescing. Only when find_fit finds nothing (and 
+ * the heap would have to be extended) does 'consolidate' free all of the 
+ * quick blocks for real, so they coalesce, and the search is tried again.
+ * 
+ * Requests up to SLAB_MAX_SIZE bytes are not served by the free lists but by
+ * a slab allocator in front of them. It carves page sized runs out of the 
+ * heap (as ordinary allocated blocks) and splits every run into slots of a 
+ * single size class. A bitmap in the head of the run records which slots are
+ * free, so the small objects have no header at all and freeing one only 
+ * flips a bit. The runs are aligned to RUN_SIZE and marked in 'run_map', 
+ * which is how mm_free tells a slot apart from an ordinary block. A run costs
+ * a whole page, so the slabs are only used once SLAB_MIN_LIVE small objects
+ * are live. Until then small requests get ordinary blocks flagged as SMALL.
  * 
- * The allocator has 10 free lists 
- * that contains specific size ranges(Rules for finding the specific 
- * list index based on size can be found in the 'get_free_list_index' function).
+ * All of the free lists and slab runs belong to an arena. The heap of an 
+ * arena is one or more segments, each with its own prologue and epilogue, 
+ * so the boundary tags never reach into another arena. The normal build has
+ * a single arena that grows contiguously. Compiled with -DMM_THREADS the
+ * allocator is thread-safe: there are NUM_ARENAS arenas with a lock each, 
+ * threads are spread over them round robin, and 'page_arena' records which 
+ * arena owns every RUN_SIZE of the heap so a block can be freed from any 
+ * thread (a segment starts on a RUN_SIZE boundary for that). Every thread also keeps a small cache of recently freed blocks per
+ * size class, which serves most mallocs without taking a lock at all.
  * 
- * When the allocator wants to find a free block then it finds the first list
- * where it could be possible to get a block that "fits". If that is not possible 
- * then it moves on the next list in order to find a free block.
+ * A block freed by a thread of another arena neither goes to the thread cache
+ * nor takes the lock of the owning arena. It is pushed on the lock-free 
+ * 'remote_frees' stack of that arena (many producers, one consumer), and the
+ * next malloc in the owning arena takes the whole stack at once and frees 
+ * the blocks in a batch.
+ * 
+ * The free block at the end of an arena's last segment is its wilderness. It
+ * is kept out of the free lists, so it is only allocated from when no free
+ * block fits, and the heap is then extended by just the shortfall beyond it.
+ * The least extension grows with the heap of the arena (see 
+ * extend_wilderness), so a growing heap calls mem_sbrk less and less often.
+ * 
+ * Requests of at least 'mmap_threshold' bytes do not come from the heap at
+ * all. Each gets a region of its own from mem_map, with a header in front of
+ * the payload that holds the size of the region. Such a block is told apart
+ * by its address, as it lies outside the address range of the heap. It is
+ * given back with mem_unmap as soon as it is freed, and realloc resizes the
+ * region with mem_remap in whole pages.
+ * 
+ * Everything that belongs to one heap (the memlib heap, the arenas and the
+ * run and arena tables) is kept in an mm_context_t. Each thread works on 
+ * the context it selected with mm_set_context, by default one over the 
+ * default memlib heap, so several independent heaps can be used at once, 
+ * e.g. one per thread or one per trace of a parallel benchmark. Only the
+ * tunables set by mm_set_* are shared by all contexts.
 */
 
 team_t team = {
@@ -63,11 +159,10 @@ team_t team = {
     ""
 };
 
-/* single word (4) or double word (8) alignment */
-#define ALIGNMENT 8
+/* ALIGNMENT (8 or 16 bytes) comes from config.h */
 
 /* rounds up to the nearest multiple of ALIGNMENT */
-#define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~0x7)
+#define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~(ALIGNMENT-1))
 
 
 #define SIZE_T_SIZE (ALIGN(sizeof(size_t)))
@@ -76,53 +171,351 @@ team_t team = {
 #define WSIZE 4 /* Word and header/footer size (bytes) */
 #define DSIZE 8 /* Double word size (bytes) */
 #define CHUNKSIZE (1<<12) /* Extend heap by this amount (bytes) */
+#define MAX_EXTEND_SIZE (1<<18) /* Largest amount the heap is extended by beyond a shortfall */
+#define EXTEND_FRACTION 64 /* The heap is extended by at least this fraction of its size */
+#define SEGMENT_OVERHEAD (4*WSIZE) /* Padding, prologue and epilogue of a heap segment */
+#define MIN_BLOCK_SIZE (2*DSIZE) /* Header, two free list pointers and footer */
 
 #define MAX(x, y) ((x) > (y)? (x) : (y))
+#define MIN(x, y) ((x) < (y)? (x) : (y))
+
+/* Flags of the header word */
+#define ALLOC 0x1 /* The block is allocated */
+#define PREV_ALLOC 0x2 /* The previous block is allocated */
+#define SMALL 0x4 /* The block holds a small request (counted in 'small_live') */
 
-/* Pack a size and allocated bit into a word */
+/* Pack a size and allocated bits into a word */
 #define PACK(size, alloc) ((size) | (alloc))
 
 /* Read and write a word at address p */
 #define GET(p) (*(unsigned int *)(p))
 #define PUT(p, val) (*(unsigned int *)(p) = (val))
 
-/* Set the pointer address of the NEXT or PREV block pointer */
-#define SET_FREE_P(p, np) (*(unsigned int *)(p) = (unsigned int)np)
+/* Set the NEXT or PREV block pointer, stored as an offset from the start of the heap */
+#define SET_FREE_P(p, np) (*(unsigned int *)(p) = heap_offset(np))
 
 /* Read the size and allocated fields from address p */
 #define GET_SIZE(p) (GET(p) & ~0x7)
-#define GET_ALLOC(p) (GET(p) & 0x1)
+#define GET_ALLOC(p) (GET(p) & ALLOC)
+#define GET_PREV_ALLOC(p) (GET(p) & PREV_ALLOC)
+
+/* Set or clear the previous allocated flag in the header at address p */
+#define SET_PREV_ALLOC(p) (GET(p) |= PREV_ALLOC)
+#define CLEAR_PREV_ALLOC(p) (GET(p) &= ~PREV_ALLOC)
 
 /* Given block ptr bp, compute address of its header and footer */
 #define HDRP(bp) ((char *)(bp) - (WSIZE)) 
-#define FTRP(bp) ((char *)(bp) + GET_SIZE(HDRP(bp)) - (DSIZE)) // Skip next blocks prev, next and header block and go to footer
+#define FTRP(bp) ((char *)(bp) + GET_SIZE(HDRP(bp)) - (DSIZE)) // Only valid for free blocks
 
 /* Get the pointer to the NEXT and PREV fields */
 #define NEXT_FRBP(bp) ((char *)(bp) + WSIZE)
 #define PREV_FRBP(bp) ((char *)(bp))
 
-/* Get the NEXT or PREV free block */
-#define NEXT_FREE_BLOCK(bp) (*(char **)NEXT_FRBP(bp))
-#define PREV_FREE_BLOCK(bp) (*(char **)PREV_FRBP(bp))
+/* Get the NEXT or PREV free block. Offset 0 is the padding word of the heap, so it stands for NULL */
+#define NEXT_FREE_BLOCK(bp) (GET(NEXT_FRBP(bp)) ? ctx->heap_base + GET(NEXT_FRBP(bp)) : NULL)
+#define PREV_FREE_BLOCK(bp) (GET(PREV_FRBP(bp)) ? ctx->heap_base + GET(PREV_FRBP(bp)) : NULL)
 
 /* Given block ptr bp, compute address of next and previous blocks */
 #define NEXT_BLKP(bp) ((char *)(bp) + GET_SIZE(((char *)(bp) - (WSIZE))))
-#define PREV_BLKP(bp) ((char *)(bp) - GET_SIZE(((char *)(bp) - (DSIZE))))
+#define PREV_BLKP(bp) ((char *)(bp) - GET_SIZE(((char *)(bp) - (DSIZE)))) // Only valid if it is free
+
+/* Size classes */
+#define NUM_FREE_LISTS 28 /* Number of size classes. The last one is the tree of blocks above 1024 bytes */
+#define TREE_INDEX (NUM_FREE_LISTS - 1) /* Index of the tree in 'free_lists' */
+#define NUM_EXACT_LISTS 15 /* Lists holding a single size (16 to 128 bytes) */
+#define MAX_EXACT_SIZE 128 /* Largest size with its own exact list */
+#define SUB_LISTS_LOG2 2 /* Each power of two is split into 2^2 lists */
+#define GOOD_FIT_PROBES 8 /* Default number of blocks a good fit search looks at */
+#define TRIM_THRESHOLD (128*(1<<10)) /* Default size of a free heap end that is given back */
+#define CONSOLIDATE_SIZE (64*(1<<10)) /* Free blocks this large coalesce the quick lists */
+#define MMAP_THRESHOLD (128*(1<<10)) /* Default size of a request that gets its own region */
+#define MAX_HEAP_LIMIT ((size_t)1 << 32) /* Largest heap the 32-bit free list offsets can address */
+#define PURGE_DECAY 4096 /* Default frees of its arena that a large block stays free before its pages are purged */
+#define PURGE_MIN_SIZE (16*(1<<10)) /* Smallest free block whose pages are purged */
+#define PURGE_INTERVAL(decay) MAX((decay) / 4, 1) /* Frees between two purge passes of an arena */
+
+#ifndef MM_DEBUG
+#define MM_DEBUG 0 /* Set to 1 to check the sizes given to mm_free_sized */
+#endif
+
+/* Blocks in regions of their own. The payload starts MAP_OFFSET bytes into the
+ * region, which begins with its size. A header word cannot hold it, as
+ * regions may be larger than 4 GiB */
+#define MAP_OFFSET ALIGN(sizeof(size_t))
+#define MAP_SIZE(bp) (*(size_t *)((char *)(bp) - MAP_OFFSET))
+#define IS_MAPPED(bp) ((char *)(bp) < ctx->heap_base || (char *)(bp) >= ctx->heap_base + ctx->heap_limit)
+
+/* Quick lists of freed blocks that are not coalesced yet */
+#define QUICK_MAX_SIZE 512 /* Largest block size kept in the quick lists */
+#define NUM_QUICK_LISTS (QUICK_MAX_SIZE / DSIZE - 1) /* One list per block size from MIN_BLOCK_SIZE */
+#define QUICK_INDEX(size) ((size) / DSIZE - 2)
+
+/* The next block of a quick list, stored in the payload */
+#define QUICK_NEXT(bp) PREV_FREE_BLOCK(bp)
+#define SET_QUICK_NEXT(bp, np) SET_FREE_P(PREV_FRBP(bp), np)
+
+/* Headroom for blocks that keep growing by realloc. Only blocks above the
+ * quick lists (and thread caches) get it, so they are always freed in place */
+#define GROW_STREAK 2 /* Growths in a row before a block gets headroom */
+#define GROW_RESERVE(size) ALIGN((size) + (size) / 2) /* Size of a block with headroom */
+
+/* The children of a node in the tree of large blocks, stored in place of the list pointers */
+#define LEFT_CHILD(bp) PREV_FREE_BLOCK(bp)
+#define RIGHT_CHILD(bp) NEXT_FREE_BLOCK(bp)
+#define SET_LEFT_CHILD(bp, cp) SET_FREE_P(PREV_FRBP(bp), cp)
+#define SET_RIGHT_CHILD(bp, cp) SET_FREE_P(NEXT_FRBP(bp), cp)
+
+/* When a node of the tree (or a large wilderness) was freed, by the purge
+ * clock of its arena, and whether its pages were purged since, stored after
+ * its child links */
+#define FREED_AT(bp) ((char *)(bp) + 2*WSIZE)
+#define PURGED(bp) ((char *)(bp) + 3*WSIZE)
+
+/* Tree order: by size and then by address, or only by address under 
+ * address-ordered first fit */
+#define TREE_LESS(bp, cp) (fit_policy == MM_FIT_ADDRESS ? (char *)(bp) < (char *)(cp) : \
+                           (GET_SIZE(HDRP(bp)) < GET_SIZE(HDRP(cp)) || \
+                            (GET_SIZE(HDRP(bp)) == GET_SIZE(HDRP(cp)) && (char *)(bp) < (char *)(cp))))
+
+/* Size classes that are treaps: the large blocks, the classes of more than 
+ * one size under best fit and every class under address-ordered first fit */
+#define IS_TREE(index) ((index) == TREE_INDEX || fit_policy == MM_FIT_ADDRESS || \
+                        (fit_policy == MM_FIT_BEST && (index) >= NUM_EXACT_LISTS))
+
+/* The largest block in the subtree of a node, which the address ordered 
+ * trees above the exact classes keep after the stamps of the node */
+#define TREE_MAX(bp) ((char *)(bp) + 4*WSIZE)
+#define NODE_END(bp) ((char *)(bp) + 5*WSIZE) /* First byte after all of the fields of a node */
+#define HAS_TREE_MAX(index) (fit_policy == MM_FIT_ADDRESS && (index) >= NUM_EXACT_LISTS)
+
+/* Priority of a node: a multiplicative hash of its address */
+#define TREE_PRIORITY(bp) ((unsigned int)(unsigned long)(bp) * 2654435761U)
+
+/* Set, clear and test the bit of a free list in the non-empty bitmap of arena a */
+#define MAP_BIT(i) (1ULL << (i))
+#define MAP_SET(a, i) ((a)->free_map |= MAP_BIT(i))
+#define MAP_CLEAR(a, i) ((a)->free_map &= ~MAP_BIT(i))
+
+/* Slab allocator for small requests */
+#define SLAB_MAX_SIZE 128 /* Requests up to this size are served by the slabs (0 disables them) */
+#define SLAB_MIN_LIVE 64 /* Live small objects needed before the slabs are used */
+#if ALIGNMENT == 16
+#define NUM_SLAB_CLASSES 8 /* Number of slot sizes */
+#else
+#define NUM_SLAB_CLASSES 12 /* Number of slot sizes */
+#endif
+#define RUN_SIZE (1<<12) /* Size and alignment of a run of slots */
+#define RUN_PAYLOAD (RUN_SIZE - WSIZE) /* The block of a run is RUN_SIZE so runs can be placed back to back */
+#define RUN_BITMAP_WORDS (RUN_SIZE / DSIZE / 32) /* Enough bits for the smallest slots */
+#define RUN_MAP_WORDS (MAX_HEAP_LIMIT / RUN_SIZE / 32 + 1) /* One bit for every RUN_SIZE of the heap */
+
+/* Head of a run. The slots follow it at RUN_SLOTS_OFFSET */
+typedef struct slab_run {
+    struct slab_run *next; /* Next run of the class with a free slot */
+    struct slab_run *prev; /* Previous run of the class with a free slot */
+    unsigned int slot_size; /* Size of every slot in the run */
+    unsigned int num_slots; /* Number of slots in the run */
+    unsigned int num_free; /* Number of free slots in the run */
+    unsigned int class_index; /* Size class of the run */
+    unsigned int free_slots[RUN_BITMAP_WORDS]; /* Bit i is set when slot i is free */
+} slab_run_t;
+
+#define RUN_SLOTS_OFFSET ALIGN(sizeof(slab_run_t))
+
+/* Index of the run that address p lies in */
+#define RUN_INDEX(p) (((char *)(p) - ctx->heap_base) / RUN_SIZE)
+
+/* Threads and arenas */
+#ifdef MM_THREADS
+#define NUM_ARENAS 8 /* Number of independently locked arenas */
+#define TCACHE_MAX_SIZE 256 /* Largest payload kept in the thread caches */
+#define TCACHE_BINS (TCACHE_MAX_SIZE / DSIZE + 1) /* One bin per 8 bytes of payload */
+#define TCACHE_COUNT 16 /* Blocks kept per bin */
+
+#define LOCK(m) pthread_mutex_lock(m)
+#define UNLOCK(m) pthread_mutex_unlock(m)
+
+/* Words of 'run_map' are shared by the arenas so they are accessed atomically */
+#define IS_RUN(i) (__atomic_load_n(&ctx->run_map[(i) / 32], __ATOMIC_RELAXED) & (1U << ((i) % 32)))
+#define RUN_MAP_SET(i) __atomic_fetch_or(&ctx->run_map[(i) / 32], 1U << ((i) % 32), __ATOMIC_RELAXED)
+#define RUN_MAP_CLEAR(i) __atomic_fetch_and(&ctx->run_map[(i) / 32], ~(1U << ((i) % 32)), __ATOMIC_RELAXED)
+#else
+#define NUM_ARENAS 1
+
+#define LOCK(m)
+#define UNLOCK(m)
+
+#define IS_RUN(i) (ctx->run_map[(i) / 32] & (1U << ((i) % 32)))
+#define RUN_MAP_SET(i) (ctx->run_map[(i) / 32] |= 1U << ((i) % 32))
+#define RUN_MAP_CLEAR(i) (ctx->run_map[(i) / 32] &= ~(1U << ((i) % 32)))
+#endif
+
+/* The state of an arena. Every block belongs to exactly one arena */
+typedef struct arena {
+    char *free_lists[NUM_FREE_LISTS];
+    unsigned long long free_map; /* Bit i is set when free_lists[i] is non-empty */
+    slab_run_t *partial_runs[NUM_SLAB_CLASSES]; /* Runs of each class that have a free slot */
+    unsigned int small_live; /* Number of live objects of at most SLAB_MAX_SIZE bytes (and small blocks in the quick lists) */
+    char *quick_lists[NUM_QUICK_LISTS]; /* Freed blocks of each size that are still marked allocated */
+    unsigned int quick_blocks; /* Number of blocks in the quick lists */
+    mm_stats_t stats; /* Counters reported by mm_get_stats */
+    char *heap_end; /* End of the last segment of the arena, NULL if it has none */
+    char *wilderness; /* Free block that ends the last segment, kept out of the free lists */
+    size_t extend_size; /* Least amount the heap is extended by when the wilderness is too small */
+    size_t heap_size; /* Bytes of the heap in the segments of the arena */
+    char *grow_block; /* Block last grown by realloc, which may hold headroom */
+    size_t grow_size; /* The size that 'grow_block' was last grown to */
+    unsigned int grow_count; /* Growths of 'grow_block' in a row */
+    unsigned int purge_clock; /* Frees that reached the arena, the clock of the purge decay */
+    unsigned int purge_countdown; /* Frees left until the next purge pass */
+#ifdef MM_THREADS
+    pthread_mutex_t lock;
+    void *remote_frees; /* Blocks freed by other arenas' threads, linked through their payload */
+#endif
+} arena_t;
+
+#ifdef MM_THREADS
+/* A thread's cache of freed blocks. The blocks stay allocated in their arena */
+typedef struct {
+    unsigned int generation; /* Generation of the context when the cache was filled */
+    void *bins[TCACHE_BINS]; /* Bin i holds blocks with i*8 to i*8+7 bytes of payload */
+    unsigned char counts[TCACHE_BINS];
+} tcache_t;
+#endif
+
+/*
+ * The state of one heap: its memlib heap, its arenas and the tables that map
+ * the heap to runs and arenas. Every thread works on the context it selected
+ * with mm_set_context, so independent heaps can be used side by side.
+ */
+struct mm_context {
+    mem_heap_t *heap; /* The memlib heap, NULL for the default one */
+    char *heap_listp;
+    char *heap_base; /* Start of the heap, which the free list offsets are relative to */
+    size_t heap_limit; /* Size of the address range of the heap (mem_maxheap) */
+    size_t heap_runs; /* RUN_SIZE units of the heap used since mm_init, the part of the tables below to clear */
+    arena_t arenas[NUM_ARENAS];
+    unsigned int *run_map; /* Bit i is set when the i'th RUN_SIZE of the heap is a run */
+#ifdef MM_THREADS
+    unsigned char *page_arena; /* Arena owning each RUN_SIZE of the heap */
+    pthread_mutex_t heap_lock; /* Serializes the calls into memlib */
+    int arena_locks_ready;
+    unsigned int next_arena; /* Arena given to the next new thread */
+    unsigned int generation; /* Value of 'heap_generation' given by the last mm_init */
+#endif
+};
 
 // Global variables
-static char *heap_listp;
-static unsigned int num_free_lists = 10;
-static char *free_lists[10];
+static mm_fit_policy_t fit_policy = MM_FIT_FIRST;
+static int good_fit_probes = GOOD_FIT_PROBES;
+static size_t trim_threshold = TRIM_THRESHOLD;
+static size_t mmap_threshold = MMAP_THRESHOLD;
+static unsigned int purge_decay = PURGE_DECAY;
+
+/* The tables of the default context are sized for the largest heap. Their
+ * pages are only committed by the system when they are touched, which is the
+ * part that the heap uses */
+static unsigned int default_run_map[RUN_MAP_WORDS];
+
+#ifdef MM_THREADS
+static unsigned char default_page_arena[MAX_HEAP_LIMIT / RUN_SIZE];
+static mm_context_t default_context = {
+    .run_map = default_run_map,
+    .page_arena = default_page_arena,
+    .heap_lock = PTHREAD_MUTEX_INITIALIZER
+};
+static unsigned int heap_generation; /* Bumped by every mm_init to invalidate the thread caches */
+static pthread_key_t tcache_key; /* Flushes the cache of an exiting thread */
+static pthread_once_t tcache_key_once = PTHREAD_ONCE_INIT;
+static __thread arena_t *thread_arena;
+static __thread tcache_t tcache;
+#else
+static mm_context_t default_context = { .run_map = default_run_map };
+#endif
+
+static __thread mm_context_t *ctx = &default_context; /* The context of the calling thread */
+
+/* The slot size of each slab class. Every slot must keep the alignment */
+static const unsigned int slab_class_sizes[NUM_SLAB_CLASSES] = {
+#if ALIGNMENT == 16
+    16, 32, 48, 64, 80, 96, 112, 128
+#else
+    8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128
+#endif
+};
+
+/*
+ * Gets the offset of a free block from the start of the heap. The heap is
+ * at most MAX_HEAP_LIMIT bytes, so 32 bits are enough even on a 64-bit host.
+ * 
+ * Input:
+ * bp - The free block or NULL
+ * 
+ * Returns:
+ * The offset of the block or 0 for NULL
+*/
+static inline unsigned int heap_offset(void *bp) {
+
+    return (bp != NULL) ? (unsigned int)((char *)bp - ctx->heap_base) : 0;
+}
 
 
 /* Function definitions */
 
-static void *insert_free_block(void *);
-static void remove_free_block(void *);
-static void *coalesce(void *);
-static char *get_free_list(size_t);
+static void *insert_free_block(arena_t *, void *);
+static void remove_free_block(arena_t *, void *);
+static void *find_good_fit(arena_t *, int, size_t);
+static char *get_list_first(arena_t *, int);
+static char *tree_insert(char *, char *, int);
+static char *tree_remove(char *, char *, int);
+static void tree_split(char *, char *, int, char **, char **);
+static char *tree_merge(char *, char *, int);
+static void tree_update(char *, int);
+static char *tree_find_fit(char *, size_t);
+static char *tree_find_first_fit(char *, size_t);
+static void *coalesce(arena_t *, void *);
 static int get_free_list_index(size_t);
+static size_t adjust_size(size_t);
+static void allocate_block(arena_t *, void *, size_t);
+static void *free_block(arena_t *, void *);
+static int quick_put(arena_t *, void *, size_t);
+static void *quick_get(arena_t *, size_t);
+static int consolidate(arena_t *);
+static void purge_arena(arena_t *);
+static void purge_tree(arena_t *, char *);
+static void purge_block(arena_t *, char *);
+static void *malloc_aligned_block(arena_t *, size_t, size_t, char *);
+static void *malloc_block(arena_t *, size_t);
+static void *take_wilderness(arena_t *, size_t);
+static void *extend_wilderness(arena_t *, size_t);
+static void *small_malloc(arena_t *, size_t);
+static void *slab_malloc(arena_t *, size_t);
+static void slab_free(arena_t *, slab_run_t *, void *);
+static slab_run_t *get_slab_run(void *);
+static arena_t *get_thread_arena(void);
+static arena_t *get_block_arena(void *);
+static void arena_free(arena_t *, void *, size_t);
+static void *realloc_block(arena_t *, void *, size_t);
+static void *resize_block(arena_t *, void *, size_t);
+static int reclaim_headroom(arena_t *);
+static void shrink_block(arena_t *, void *, size_t);
+static int is_heap_top(void *);
+static void *trim_heap(arena_t *, void *);
+static size_t usable_size(void *);
+static void *map_malloc(size_t);
+static void map_free(void *);
+static void *map_realloc(void *, size_t);
+static int carve_blocks(arena_t *, size_t, int, void **);
+static int free_adjacent(arena_t *, void **, int);
+static int compare_pointers(const void *, const void *);
+#ifdef MM_THREADS
+static void *tcache_get(size_t);
+static int tcache_put(void *, size_t);
+static void remote_free(arena_t *, void *);
+static void drain_remote_frees(arena_t *);
+#endif
 static void mm_check();
+static void mm_check_tree(int, char *);
 static void print_pointer_info(char *, void *);
 
 
@@ -137,33 +530,111 @@ static void print_pointer_info(char *, void *);
  * If no one of the free blocks can fulfill that requirement then it 
  * returns NULL.
 */
-static void *find_fit(size_t size) {
+static void *find_fit(arena_t *a, size_t size) {
 
     // Get index for free list based on size
     int index = get_free_list_index(size); 
+    char *root = a->free_lists[index];
+    char *fit = NULL;
+
+    if(fit_policy == MM_FIT_GOOD && index != TREE_INDEX)
+        fit = find_good_fit(a, index, size);
+    else if(HAS_TREE_MAX(index))
+        fit = tree_find_first_fit(root, size);
+    else if(fit_policy == MM_FIT_ADDRESS)
+        // Every block of an exact class fits, and the lowest one is the leftmost
+        fit = (root != NULL) ? get_list_first(a, index) : NULL;
+    else if(IS_TREE(index))
+        fit = tree_find_fit(root, size);
+    else {
+        /* Go through the list of the size class and take the first that fits */
+        for(char *current = root; current != NULL; current = NEXT_FREE_BLOCK(current)) {
+
+            /* If the size of the current free block is greater than the requested
+            then take it */ 
+            if(GET_SIZE(HDRP(current)) >= size) {
+                fit = current;
+                break;
+            }
+        }
+    }
 
-    for(int i = index; i < num_free_lists; i++) {
+    // A block at a lower address may still be found in a larger size class
+    if(fit != NULL && fit_policy != MM_FIT_ADDRESS)
+        return fit;
 
-        char *current = free_lists[i];
+    unsigned long long larger = a->free_map & (~0ULL << (index + 1));
 
-        if(current == NULL)
-            continue;
+    if(larger == 0)
+        return fit;
 
-        // Go through the list and take the first that fits
-        while(current != NULL) {
+    /* Every block in a larger size class fits, so take the head of the
+    first non-empty list above the index */
+    if(fit_policy != MM_FIT_ADDRESS)
+        return get_list_first(a, __builtin_ctzll(larger));
 
-            size_t current_size = GET_SIZE(HDRP(current)); 
+    // The first blocks are the lowest addresses of their classes
+    for(; larger != 0; larger &= larger - 1) {
+        char *head = get_list_first(a, __builtin_ctzll(larger));
 
-            /* If the size of the current free block is greater than the requested
-            then return it */ 
-            if(current_size >= size)
-                return current;
-                
-            current = NEXT_FREE_BLOCK(current);    
-        }
+        if(fit == NULL || head < fit)
+            fit = head;
     }
 
-    return NULL;
+    return fit;
+}
+
+/*
+ * Searches the list of a size class for a good fit. At most 'good_fit_probes'
+ * blocks are looked at, and the smallest of them that fits is taken.
+ * 
+ * Inputs:
+ * index - The index of the free list
+ * size - The size the block of memory should have
+ * 
+ * Returns:
+ * The best block among the probed ones or NULL if none of them fits
+*/
+static void *find_good_fit(arena_t *a, int index, size_t size) {
+
+    char *fit = NULL;
+    int probes = good_fit_probes;
+
+    for(char *current = a->free_lists[index]; current != NULL && probes > 0; current = NEXT_FREE_BLOCK(current), probes--) {
+
+        size_t current_size = GET_SIZE(HDRP(current));
+
+        if(current_size == size)
+            return current;
+
+        if(current_size > size && (fit == NULL || current_size < GET_SIZE(HDRP(fit))))
+            fit = current;
+    }
+
+    return fit;
+}
+
+/*
+ * Gets the block that a search takes from a non-empty size class in which 
+ * every block fits. That is the head of a list, or the leftmost node of a
+ * tree (the smallest block, or the lowest one under address-ordered first 
+ * fit).
+ * 
+ * Input:
+ * index - The index of the size class
+ * 
+ * Returns:
+ * The first block of the size class
+*/
+static char *get_list_first(arena_t *a, int index) {
+
+    char *first = a->free_lists[index];
+
+    if(IS_TREE(index))
+        while(LEFT_CHILD(first) != NULL)
+            first = LEFT_CHILD(first);
+
+    return first;
 }
 
 /*
@@ -178,25 +649,37 @@ static void *find_fit(size_t size) {
  * bp - pointer to the block of memory that should be placed
  * asize - the size that should be placed
 */
-static void place(void *bp, size_t asize) {
+static void place(arena_t *a, void *bp, size_t asize) {
+    
+    remove_free_block(a, bp);
+    allocate_block(a, bp, asize);
+}
+
+/*
+ * Marks a block that is not in a free list as allocated. The rest of the block
+ * is split off and inserted into the free list the same way as in 'place'
+ * 
+ * Inputs:
+ * bp - pointer to the block of memory that should be allocated
+ * asize - the size that should be allocated
+*/
+static void allocate_block(arena_t *a, void *bp, size_t asize) {
     size_t size = GET_SIZE(HDRP(bp));
     size_t size_diff = size - asize;
-    unsigned int should_split = size_diff >= 2 * DSIZE;
-    
-    remove_free_block(bp);
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+    unsigned int should_split = size_diff >= MIN_BLOCK_SIZE;
 
     if(!should_split) {
 
-        PUT(HDRP(bp), PACK(size, 1));
-        PUT(FTRP(bp), PACK(size, 1)); 
+        PUT(HDRP(bp), PACK(size, prev_alloc | ALLOC));
+        SET_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
     } else { // Split bp and inserted the rest into the free list
-        PUT(HDRP(bp), PACK(asize, 1));
-        PUT(FTRP(bp), PACK(asize, 1));
+        PUT(HDRP(bp), PACK(asize, prev_alloc | ALLOC));
 
         void *split_p = NEXT_BLKP(bp);
-        PUT(HDRP(split_p), PACK(size_diff, 0));
+        PUT(HDRP(split_p), PACK(size_diff, PREV_ALLOC));
         PUT(FTRP(split_p), PACK(size_diff, 0));
-        insert_free_block(split_p);
+        insert_free_block(a, split_p);
     }
 }
 
@@ -209,9 +692,9 @@ static void place(void *bp, size_t asize) {
  * Returns:
  * A pointer to the coalesced block
 */
-static void *coalesce(void *bp)
+static void *coalesce(arena_t *a, void *bp)
 {
-    size_t prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp)));
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
     size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
     size_t size = GET_SIZE(HDRP(bp));
 
@@ -222,21 +705,21 @@ static void *coalesce(void *bp)
         size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
         
         // Clean next and prev pointers of the right free block
-        remove_free_block(NEXT_BLKP(bp));
+        remove_free_block(a, NEXT_BLKP(bp));
 
         // Coalesce the two free blocks
-        PUT(HDRP(bp), PACK(size, 0));
+        PUT(HDRP(bp), PACK(size, PREV_ALLOC));
         PUT(FTRP(bp), PACK(size,0));
     } else if (!prev_alloc && next_alloc) { /* Case 3 */
 
         size += GET_SIZE(HDRP(PREV_BLKP(bp)));
 
         // Clean next and prev pointers of the left free block
-        remove_free_block(PREV_BLKP(bp));
+        remove_free_block(a, PREV_BLKP(bp));
 
-        // Coalesce the two free blocks
+        // Coalesce the two free blocks. The block left of a free block is always allocated
         PUT(FTRP(bp), PACK(size, 0));
-        PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
+        PUT(HDRP(PREV_BLKP(bp)), PACK(size, PREV_ALLOC));
 
         bp = PREV_BLKP(bp);
     }
@@ -244,11 +727,11 @@ static void *coalesce(void *bp)
         size += GET_SIZE(HDRP(PREV_BLKP(bp))) + GET_SIZE(FTRP(NEXT_BLKP(bp)));
 
         // Clean next and prev pointers of both the right and left free block
-        remove_free_block(NEXT_BLKP(bp));
-        remove_free_block(PREV_BLKP(bp));
+        remove_free_block(a, NEXT_BLKP(bp));
+        remove_free_block(a, PREV_BLKP(bp));
 
         // Coalesce the three blocks into one common block
-        PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
+        PUT(HDRP(PREV_BLKP(bp)), PACK(size, PREV_ALLOC));
         PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 0));
         bp = PREV_BLKP(bp);
     }
@@ -257,32 +740,161 @@ static void *coalesce(void *bp)
 }
 
 /*
- * Extends the heap with more memory and inserts the free memory into the 
- * segregated free list.
+ * Extends the heap of the arena with more memory, which is coalesced with 
+ * the wilderness and becomes the new wilderness.
+ * 
+ * If the arena owns the end of the heap then the new memory continues its 
+ * last segment. Otherwise (the first time, or when another arena extended 
+ * the heap in the meantime) the memory becomes a new segment with its own 
+ * prologue and epilogue.
  * 
  * Input:
  * The size to extend the heap with
  * 
  * Returns:
- * Pointer to the new free block of memory
+ * Pointer to the wilderness
 */
-static void *extend_heap(size_t words) {
+static void *extend_heap(arena_t *a, size_t words) {
     char *bp;
     size_t size;
 
-    /* Allocate an even number of words to maintain alignment */
-    size = (words % 2) ? (words+1) * WSIZE : words * WSIZE;
-    if ((long)(bp = mem_sbrk(size)) == -1)
+    /* Allocate a multiple of the alignment to maintain it */
+    size = ALIGN(words * WSIZE);
+
+    LOCK(&ctx->heap_lock);
+
+    char *brk = (char *)mem_heap_hi_h(ctx->heap) + 1;
+    int contiguous = a->heap_end != NULL && a->heap_end == brk;
+    size_t pad = 0;
+
+#ifdef MM_THREADS
+    // A new segment starts on a RUN_SIZE boundary, so that every RUN_SIZE of
+    // the heap belongs to a single arena
+    if (!contiguous)
+        pad = -(size_t)(brk - ctx->heap_base) & (RUN_SIZE - 1);
+#endif
+
+    size_t incr = pad + (contiguous ? size : size + SEGMENT_OVERHEAD);
+
+    if ((long)(bp = mem_sbrk_h(ctx->heap, incr)) == -1) {
+        UNLOCK(&ctx->heap_lock);
         return NULL;
+    }
+
+#ifdef MM_THREADS
+    for(size_t i = RUN_INDEX(bp + pad); i <= RUN_INDEX(bp + incr - 1); i++)
+        ctx->page_arena[i] = a - ctx->arenas;
+#endif
+
+    ctx->heap_runs = MAX(ctx->heap_runs, RUN_INDEX(bp + incr - 1) + 1);
+    bp += pad;
+
+    UNLOCK(&ctx->heap_lock);
+    a->heap_size += incr;
+    a->stats.extensions++;
+
+    // The wilderness of the old segment becomes an ordinary free block
+    char *old_wilderness = NULL;
+    if (!contiguous) {
+        old_wilderness = a->wilderness;
+        a->wilderness = NULL;
+    }
+
+    if (!contiguous) {
 
-    /* Initialize free block header/footer and the epilogue header */
-    PUT(HDRP(bp), PACK(size, 0)); /* Free block header */
+        /* Alignment padding, prologue header and footer */
+        PUT(bp, 0);
+        PUT(bp + (1*WSIZE), PACK(DSIZE, ALLOC));
+        PUT(bp + (2*WSIZE), PACK(DSIZE, ALLOC));
+
+        /* The epilogue header that the new free block takes over */
+        PUT(bp + (3*WSIZE), PACK(0, PREV_ALLOC | ALLOC));
+        bp += SEGMENT_OVERHEAD;
+    }
+
+    a->heap_end = bp + size;
+
+    /* 
+     * Initialize free block header/footer and the epilogue header. The header
+     * takes over the previous allocated flag of the old epilogue header 
+     */
+    PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp)))); /* Free block header */
     PUT(FTRP(bp), PACK(size, 0)); /* Free block footer */
-    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); /* New epilogue header */
+    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, ALLOC)); /* New epilogue header */
+
+    if (old_wilderness != NULL)
+        insert_free_block(a, old_wilderness);
+
+    /* Coalesces with the wilderness, if the previous block is the wilderness,
+     * and the result becomes the new wilderness */
+    return insert_free_block(a, bp);
+}
 
-    /* Coalesce if the previous block was free */
-     
-    return insert_free_block(bp);
+/*
+ * Checks if a block pointer is the end of the heap, i.e. if extend_heap 
+ * would continue the segment ending there
+ * 
+ * Input:
+ * bp - The block pointer of an epilogue
+ * 
+ * Returns:
+ * 1 if no memory has been allocated after the epilogue, otherwise 0
+*/
+static int is_heap_top(void *bp) {
+
+    LOCK(&ctx->heap_lock);
+    int top = (char *)bp == (char *)mem_heap_hi_h(ctx->heap) + 1;
+    UNLOCK(&ctx->heap_lock);
+
+    return top;
+}
+
+/*
+ * Shrinks the heap when a free block at its end has reached the trim 
+ * threshold. Half of the threshold stays in the block, so a following 
+ * malloc of less than that does not have to extend the heap right away.
+ * 
+ * Inputs:
+ * a - The arena of the block
+ * bp - A free block that has been coalesced and inserted into a free list
+ * 
+ * Returns:
+ * The free block
+*/
+static void *trim_heap(arena_t *a, void *bp) {
+    size_t size = GET_SIZE(HDRP(bp));
+
+    // Only the last block of the arena's last segment can be given back
+    if(trim_threshold == 0 || size < trim_threshold || NEXT_BLKP(bp) != a->heap_end)
+        return bp;
+
+    size_t release = size - MAX(ALIGN(trim_threshold / 2), MIN_BLOCK_SIZE);
+
+    if(release == 0)
+        return bp;
+
+    // The segment must still end the heap when the heap is shrunk
+    LOCK(&ctx->heap_lock);
+    int top = a->heap_end == (char *)mem_heap_hi_h(ctx->heap) + 1;
+    if(top)
+        mem_sbrk_h(ctx->heap, -(intptr_t)release);
+    UNLOCK(&ctx->heap_lock);
+
+    if(!top)
+        return bp;
+
+    remove_free_block(a, bp);
+
+    size -= release;
+    PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp))));
+    PUT(FTRP(bp), PACK(size, 0));
+    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, ALLOC)); /* New epilogue header */
+    a->heap_end -= release;
+    a->heap_size -= release;
+    a->extend_size = CHUNKSIZE;
+
+    a->stats.trims++;
+    return insert_free_block(a, bp);
 }
 
 /* 
@@ -290,30 +902,66 @@ static void *extend_heap(size_t words) {
  */
 int mm_init(void)
 {
-    /* Create the initial empty heap */
-    if ((heap_listp = mem_sbrk(4*WSIZE)) == (void *)-1)
-        return -1;
+    for(int n = 0; n < NUM_ARENAS; n++) {
+        arena_t *a = &ctx->arenas[n];
+
+        // Initialize the free lists. Ensure they are set to null
+        for(int i = 0; i < NUM_FREE_LISTS; i++) 
+            a->free_lists[i] = NULL;
+        a->free_map = 0;
+
+        // There are no slab runs in the new heap
+        for(int i = 0; i < NUM_SLAB_CLASSES; i++)
+            a->partial_runs[i] = NULL;
+        a->small_live = 0;
+
+        for(int i = 0; i < NUM_QUICK_LISTS; i++)
+            a->quick_lists[i] = NULL;
+        a->quick_blocks = 0;
+        memset(&a->stats, 0, sizeof(a->stats));
+
+        // The arena gets its first segment when it is extended
+        a->heap_end = NULL;
+        a->wilderness = NULL;
+        a->extend_size = CHUNKSIZE;
+        a->heap_size = 0;
+        a->grow_block = NULL;
+        a->purge_clock = 0;
+        a->purge_countdown = PURGE_INTERVAL(purge_decay);
+
+#ifdef MM_THREADS
+        if(!ctx->arena_locks_ready)
+            pthread_mutex_init(&a->lock, NULL);
+        a->remote_frees = NULL;
+#endif
+    }
+    // Only the part of the tables that the last heap reached is dirty
+    memset(ctx->run_map, 0, (ctx->heap_runs / 32 + 1) * sizeof(unsigned int));
 
-    // Initialize the free lists. Ensure they are set to null
-    for(int i = 0; i < num_free_lists; i++) 
-        free_lists[i] = NULL;
+#ifdef MM_THREADS
+    ctx->arena_locks_ready = 1;
+    memset(ctx->page_arena, 0, ctx->heap_runs);
 
-    /* Alignment padding */
-    PUT(heap_listp, 0);                          
-    
-    /* Prologue header */
-    PUT(heap_listp + (1*WSIZE), PACK(DSIZE, 1)); 
-    PUT(heap_listp + (2*WSIZE), PACK(DSIZE, 1)); /* Prologue footer */
+    // Blocks in the thread caches belong to the old heap
+    ctx->generation = __sync_add_and_fetch(&heap_generation, 1);
+#endif
 
-    /* Epilogue header */
-    PUT(heap_listp + (3*WSIZE), PACK(0, 1)); 
+    if (ctx->heap == NULL)
+        ctx->heap = mem_default_heap();
 
-    heap_listp += DSIZE; // Point to the first data bp
+    ctx->heap_runs = 0;
+    ctx->heap_base = mem_heap_lo_h(ctx->heap);
+    ctx->heap_limit = mem_maxheap_h(ctx->heap);
 
-    /* Extend the empty heap with a free block of CHUNKSIZE bytes */
-    if (extend_heap(CHUNKSIZE/WSIZE) == NULL)
+    if (ctx->heap_limit > MAX_HEAP_LIMIT)
         return -1;
 
+    /* Create the initial heap with a free block of CHUNKSIZE bytes */
+    if (extend_heap(&ctx->arenas[0], CHUNKSIZE/WSIZE) == NULL)
+        return -1;
+
+    ctx->heap_listp = ctx->heap_base + DSIZE; // Point to the prologue of the first segment
+
     return 0;
 }
 
@@ -331,237 +979,2084 @@ int mm_init(void)
  */
 void *mm_malloc(size_t size)
 {
-    size_t asize; /* Adjusted block size */
-    size_t extendsize; /* Amount to extend heap if no fit */
-    char *bp;
+    void *bp;
 
     /* Ignore spurious requests */
     if (size == 0)
         return NULL;
 
-    /* Adjust block size to include overhead and alignment reqs. */
-    if (size <= DSIZE)
-            asize = 2 * DSIZE; // Sets size to 2 * DSIZE (for header and footer)
-    else
-        asize = ALIGN(size + DSIZE); 
-
-    /* Search the free list for a fit */
-    if ((bp = find_fit(asize)) != NULL) {
-        place(bp, asize);
-        return bp; 
-    }
-
-    /* No fit found. Get more memory and place the block */
-    extendsize = MAX(asize,CHUNKSIZE);
-    if ((bp = extend_heap(extendsize/WSIZE)) == NULL)
-        return NULL;
+    /* Huge requests get a region of their own */
+    if (mmap_threshold != 0 && size >= mmap_threshold)
+        return map_malloc(size);
 
-    place(bp, asize);
-    return bp;
-}
+#ifdef MM_THREADS
+    /* A recently freed block of the thread needs no lock */
+    if ((bp = tcache_get(size)) != NULL)
+        return bp;
+#endif
 
-/*
- * Freeing the block og memory and inserts it into the 
- * segregated free list.
- * 
- * Input:
- * bp - the block of memory to be free'ed
- */
-void mm_free(void *bp) {
+    arena_t *a = get_thread_arena();
+    LOCK(&a->lock);
 
-    // If the block pointer is null then do nothing...
-    if(bp == NULL)
-        return;
+#ifdef MM_THREADS
+    /* Free the blocks that other threads gave back to the arena */
+    if (__atomic_load_n(&a->remote_frees, __ATOMIC_RELAXED) != NULL)
+        drain_remote_frees(a);
+#endif
 
-    // Set header and footer to signal that it is not allocated
-    size_t size = GET_SIZE(HDRP(bp));
-    PUT(HDRP(bp), PACK(size, 0));
-    PUT(FTRP(bp), PACK(size, 0));
+    /* Small requests may be served by the slabs */
+    if (size <= SLAB_MAX_SIZE)
+        bp = small_malloc(a, size);
+    else /* Adjust block size to include overhead and alignment reqs. */
+        bp = malloc_block(a, adjust_size(size));
 
-    // Insert the free block into the segregated free list
-    insert_free_block(bp);
+    UNLOCK(&a->lock);
+    return bp;
 }
 
 /*
- * Extends the current allocated block if possible or if the size is below the current allocated size then it does nothing. 
- * If it is not possible then it reallocates the block of memory.
+ * Allocates a block whose payload address is a multiple of the alignment.
+ * The gap in front of the payload is split off as a free block of its own,
+ * so no padding is wasted inside the block.
  * 
  * Inputs:
- * ptr - The pointer to the block of memory that needs to be allocated
- * size - The new size that it needs to be allocated to
+ * alignment - The alignment of the payload. Must be a power of two
+ * size - The requested size
  * 
  * Returns:
- * The pointer to the reallocated block of memory
+ * The pointer to the aligned payload, or NULL if the alignment is not a 
+ * power of two or the heap is full
  */
-void *mm_realloc(void *ptr, size_t size)
+void *mm_memalign(size_t alignment, size_t size)
 {
-    size_t aligned_size = ALIGN(size + DSIZE);
-    size_t current_size = GET_SIZE(HDRP(ptr));
+    void *bp;
 
-    // Handle cases where we do not extend the current block or reallocates it
-    if(size < 0)
+    if (size == 0 || alignment == 0 || (alignment & (alignment - 1)) != 0)
         return NULL;
-    else if(size == 0) {
-        mm_free(ptr); // Free the block since size is 0
-        return NULL;
-    } else if(current_size >= aligned_size) {
-        return ptr; // We can return the same block since the aligned size fits in the current
-    }
 
-    void *oldptr = ptr;
-    size_t old_size = GET_SIZE(HDRP(oldptr));
-    void *old_next_ptr = NEXT_BLKP(oldptr);
-    size_t old_next_size = GET_SIZE(HDRP(old_next_ptr));
-    
-    // If the next block is not alloacted and that the size is bigger then the requested size
-    if(!GET_ALLOC(HDRP(old_next_ptr)) && (old_size+old_next_size) >= aligned_size) {
-
-        size_t new_size = old_size + old_next_size;
+    /* Every payload is aligned that much anyway */
+    if (alignment <= ALIGNMENT)
+        return mm_malloc(size);
 
-        remove_free_block(old_next_ptr); // Remove the free block from free list
+    arena_t *a = get_thread_arena();
+    LOCK(&a->lock);
 
-        PUT(HDRP(oldptr), PACK(new_size, 1));
-        PUT(FTRP(oldptr), PACK(new_size, 1));
+#ifdef MM_THREADS
+    if (__atomic_load_n(&a->remote_frees, __ATOMIC_RELAXED) != NULL)
+        drain_remote_frees(a);
+#endif
 
-        return oldptr;
-    } 
+    /* Huge aligned requests come from the heap too, as a region of their 
+     * own is only aligned to a page */
+    bp = malloc_aligned_block(a, adjust_size(size), alignment, NULL);
 
-    /* If the block cannot be extended by the blocks beside it then we need
-     * to allocate a new fresh block
-    */
-    void *newptr = mm_malloc(size);
-    if (newptr == NULL)
-      return NULL;
-    size_t copySize = *(size_t *)((char *)oldptr - WSIZE);
-    if (size < copySize)
-      copySize = size;
-    memcpy(newptr, oldptr, copySize);
-    mm_free(oldptr);
-    return newptr;
+    UNLOCK(&a->lock);
+    return bp;
 }
 
 /*
- * Coalesces the bp and inserts the resulting_bp into the segregated free list
- *
+ * Allocates an ordinary block from the segregated free list and extends the
+ * heap if no free block fits.
+ * 
  * Input:
- * A free block to be inserted
+ * asize - The adjusted block size
  * 
  * Returns:
- * The free block coalesced
-*/
-static void *insert_free_block(void *bp) {
-
-    void *result_bp = coalesce(bp);
-    char *free_listp = get_free_list(GET_SIZE(HDRP(result_bp)));
-    char *old_free_listp = free_listp;
+ * The pointer to the allocated block or NULL if the heap is full
+ */
+static void *malloc_block(arena_t *a, size_t asize)
+{
+    char *bp;
 
-    // Check that the old free list pointer is not null
-    if(old_free_listp != NULL) 
-        SET_FREE_P(PREV_FRBP(old_free_listp), result_bp); // Insert old free list pointer
-    else 
-        SET_FREE_P(NEXT_FRBP(result_bp), NULL); 
-    
-    // Make sure that it doesn't set it self to be the next in the free list
-    if(old_free_listp != result_bp)
-        SET_FREE_P(NEXT_FRBP(result_bp), old_free_listp);
+    /* A quick list holds blocks of exactly the size */
+    if ((bp = quick_get(a, asize)) != NULL)
+        return bp;
 
-    /* 
-    *  Since the new free block is being inserted 
-    *  at the start of the list then there is no previous 
-    */
-    SET_FREE_P(PREV_FRBP(result_bp), NULL);
+    /* Search the free list for a fit, and again after coalescing the quick 
+     * lists and after taking back the headroom of a growing block */
+    if ((bp = find_fit(a, asize)) != NULL || 
+        (consolidate(a) && (bp = find_fit(a, asize)) != NULL) ||
+        (reclaim_headroom(a) && (bp = find_fit(a, asize)) != NULL)) {
+        place(a, bp, asize);
+        return bp; 
+    }
 
-    // Sets the top of the list where the size of the new block should be in
-    size_t size = GET_SIZE(HDRP(result_bp));
-    int index = get_free_list_index(size);
-    free_lists[index] = result_bp;
+    /* No fit found. Carve the block from the wilderness, which the heap is
+     * extended into if it is too small. The rest stays the wilderness */
+    if ((bp = take_wilderness(a, asize)) == NULL)
+        return NULL;
 
-    return result_bp;
+    allocate_block(a, bp, asize);
+    return bp;
 }
 
 /*
- * Remove the block from the free list and binds the surounding free block together
- *
- * Input:
- * bp - The free block to be removed from the free list
+ * Takes the wilderness of the arena out so a block can be allocated from 
+ * its start. If it is smaller than the size, the heap is extended by the
+ * shortfall first.
+ * 
+ * Inputs:
+ * a - The arena
+ * size - The size of the block that is needed
+ * 
+ * Returns:
+ * A free block of at least the size that is in no free list, or NULL if the 
+ * heap cannot be extended
 */
-static void remove_free_block(void *bp) {
-
-    size_t size = GET_SIZE(HDRP(bp));
-    int free_list_index = get_free_list_index(size);
-
-    void *next = NEXT_FREE_BLOCK(bp);
-    void *prev = PREV_FREE_BLOCK(bp);
-
-    // Remove previous block pointer refs
-    SET_FREE_P(NEXT_FRBP(bp), NULL);
-    SET_FREE_P(PREV_FRBP(bp), NULL); 
-
-    /* 
-    *   If the current block(that is going to be removed) 
-    *   then set beginning of free_listp to the next pointer 
-    */
-    if(bp == free_lists[free_list_index])
-        free_lists[free_list_index] = next;
-
-    if(next != NULL && prev != NULL) {
-
-        SET_FREE_P(NEXT_FRBP(prev), next);
-        SET_FREE_P(PREV_FRBP(next), prev);
-    } else if (next != NULL && prev == NULL) {
+static void *take_wilderness(arena_t *a, size_t size)
+{
+    char *bp = a->wilderness;
+    size_t have = (bp != NULL) ? GET_SIZE(HDRP(bp)) : 0;
 
-        SET_FREE_P(PREV_FRBP(next), NULL);
-    } else if (next == NULL && prev != NULL) {
+    // A new segment does not continue the old wilderness, so it may take two tries
+    while(have < size) {
+        if((bp = extend_wilderness(a, size - have)) == NULL)
+            return NULL;
 
-        SET_FREE_P(NEXT_FRBP(prev), NULL);     
+        have = GET_SIZE(HDRP(bp));
     }
 
+    a->wilderness = NULL;
+    return bp;
 }
 
 /*
- * Get the pointer to the first that the item size "fits" in
+ * Extends the heap by a shortfall, but at least by 'extend_size'. That is
+ * a fraction of the heap of the arena (between CHUNKSIZE and 
+ * MAX_EXTEND_SIZE), so a heap that keeps growing calls mem_sbrk less and 
+ * less often while the unused end stays small compared to the heap.
  * 
- * Input:
- * size - the size that the block could be in
+ * Inputs:
+ * a - The arena
+ * shortfall - The number of bytes that are missing
  * 
  * Returns:
- * The pointer to the first block in the free linked list
+ * The wilderness after the extension, or NULL if the heap cannot be extended
 */
-static char *get_free_list(size_t size) {
+static void *extend_wilderness(arena_t *a, size_t shortfall)
+{
+    void *bp = extend_heap(a, MAX(shortfall, a->extend_size)/WSIZE);
 
-    return free_lists[get_free_list_index(size)];
+    a->extend_size = MIN(MAX(a->heap_size / EXTEND_FRACTION, CHUNKSIZE), MAX_EXTEND_SIZE);
+    return bp;
 }
 
 /*
- * Gets the index that the size should be in
- *
- * Input:
- * size - The size that the list should be able to hold
+ * Freeing the block og memory and inserts it into the 
+ * segregated free list.
  * 
- * Returns:
- * The index of the free list
-*/
-static int get_free_list_index(size_t size) { 
-   if (size > 16384)
-        return 9;
-    else if (size > 8192)
-        return 8;
-    else if (size > 4096)
-        return 7;
-    else if (size > 2048)
-        return 6;
-    else if (size > 1024)
-        return 5;
-    else if (size > 512)
-        return 4;
-    else if (size > 256)
-        return 3;
-    else if (size > 128)
-        return 2;
-    else if (size > 64)
-        return 1;
-    else
-        return 0; 
+ * Input:
+ * bp - the block of memory to be free'ed
+ */
+void mm_free(void *bp) {
+
+    // If the block pointer is null then do nothing...
+    if(bp == NULL)
+        return;
+
+    if(IS_MAPPED(bp)) {
+        map_free(bp);
+        return;
+    }
+
+    arena_t *a = get_block_arena(bp);
+
+#ifdef MM_THREADS
+    // Blocks of another arena are queued for the threads of that arena
+    if(a != get_thread_arena()) {
+        remote_free(a, bp);
+        return;
+    }
+
+    // Keep the block in the thread cache if there is room for it
+    if(tcache_put(bp, usable_size(bp)))
+        return;
+#endif
+
+    LOCK(&a->lock);
+    arena_free(a, bp, 0);
+    UNLOCK(&a->lock);
+}
+
+/*
+ * Frees a block whose requested size the caller knows. The size picks the
+ * thread cache bin and the quick list, so a block that goes there is freed
+ * without reading its header. A larger block is coalesced, which reads the
+ * header anyway. A debug build checks the size against the header.
+ * 
+ * Inputs:
+ * bp - the block of memory to be free'ed
+ * size - the size it was allocated or last reallocated with
+ */
+void mm_free_sized(void *bp, size_t size) {
+
+    if(bp == NULL)
+        return;
+
+#if MM_DEBUG
+    if(size > usable_size(bp)) {
+        fprintf(stderr, "mm_free_sized: %lu bytes do not fit the block %p of %lu bytes\n",
+                (unsigned long)size, bp, (unsigned long)usable_size(bp));
+        abort();
+    }
+#endif
+
+    if(IS_MAPPED(bp)) {
+        map_free(bp);
+        return;
+    }
+
+    arena_t *a = get_block_arena(bp);
+
+#ifdef MM_THREADS
+    if(a != get_thread_arena()) {
+        remote_free(a, bp);
+        return;
+    }
+
+    if(tcache_put(bp, size))
+        return;
+#endif
+
+    LOCK(&a->lock);
+    arena_free(a, bp, adjust_size(size));
+    UNLOCK(&a->lock);
+}
+
+/*
+ * Frees a block or slab slot in the arena it belongs to
+ * 
+ * Inputs:
+ * a - the arena of the block
+ * bp - the block of memory to be free'ed
+ * asize - the size of the block, or a size it is known to exceed, which 
+ *         picks its quick list. 0 reads the size from the header
+ */
+static void arena_free(arena_t *a, void *bp, size_t asize) {
+
+    if(bp == a->grow_block)
+        a->grow_block = NULL;
+
+    // Every free advances the purge clock, and a pass runs now and then
+    a->purge_clock++;
+    if(purge_decay != 0 && --a->purge_countdown == 0)
+        purge_arena(a);
+
+    // A slot of a slab run is only marked as free in its run
+    slab_run_t *run = get_slab_run(bp);
+    if(run != NULL) {
+        slab_free(a, run, bp);
+        return;
+    }
+
+    if(asize == 0)
+        asize = GET_SIZE(HDRP(bp));
+
+    // Small blocks wait in a quick list for the next request of their size
+    if(quick_put(a, bp, asize))
+        return;
+
+    // A large free block means that a lot of memory was given back, so the
+    // quick lists are coalesced too, as they may pin the end of the heap
+    bp = free_block(a, bp);
+    if(GET_SIZE(HDRP(bp)) >= CONSOLIDATE_SIZE)
+        consolidate(a);
+}
+
+/*
+ * Frees an ordinary block (not a slab slot) and inserts it into the
+ * segregated free list.
+ * 
+ * Input:
+ * bp - the block of memory to be free'ed
+ * 
+ * Returns:
+ * The free block after coalescing
+ */
+static void *free_block(arena_t *a, void *bp) {
+
+    if(GET(HDRP(bp)) & SMALL)
+        a->small_live--;
+
+    // Set header and footer to signal that it is not allocated
+    size_t size = GET_SIZE(HDRP(bp));
+    PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp))));
+    PUT(FTRP(bp), PACK(size, 0));
+    CLEAR_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
+
+    // Insert the free block into the segregated free list
+    bp = insert_free_block(a, bp);
+    return trim_heap(a, bp);
+}
+
+/*
+ * Extends the current allocated block if possible or if the size is below the current allocated size then it does nothing. 
+ * If it is not possible then it reallocates the block of memory.
+ * 
+ * Inputs:
+ * ptr - The pointer to the block of memory that needs to be allocated
+ * size - The new size that it needs to be allocated to
+ * 
+ * Returns:
+ * The pointer to the reallocated block of memory
+ */
+void *mm_realloc(void *ptr, size_t size)
+{
+    // Handle cases where we do not extend the current block or reallocates it
+    if(ptr == NULL)
+        return mm_malloc(size);
+    else if(size == 0) {
+        mm_free(ptr); // Free the block since size is 0
+        return NULL;
+    }
+
+    void *resized;
+
+    if(IS_MAPPED(ptr)) {
+        // A region is resized in whole pages as long as the size stays huge
+        if(mmap_threshold != 0 && size >= mmap_threshold && (resized = map_realloc(ptr, size)) != NULL)
+            return resized;
+    } else {
+        arena_t *a = get_block_arena(ptr);
+        LOCK(&a->lock);
+        resized = realloc_block(a, ptr, size);
+        UNLOCK(&a->lock);
+
+        if(resized != NULL)
+            return resized;
+    }
+
+    /* If the block cannot be extended by the blocks beside it then we need
+     * to allocate a new fresh block
+    */
+    void *newptr = mm_malloc(size);
+    if (newptr == NULL)
+      return NULL;
+    size_t copySize = usable_size(ptr);
+    if (size < copySize)
+      copySize = size;
+    memcpy(newptr, ptr, copySize);
+
+    if(!IS_MAPPED(ptr)) {
+        arena_t *a = get_block_arena(ptr);
+        LOCK(&a->lock);
+        a->stats.realloc_moves++;
+        a->stats.bytes_copied += copySize;
+        UNLOCK(&a->lock);
+    }
+
+    mm_free(ptr);
+    return newptr;
+}
+
+/*
+ * Selects the policy that find_fit uses to choose among the free blocks
+ * that fit. Size classes built before the call keep their order, so it 
+ * should be called before mm_init.
+ * 
+ * Inputs:
+ * policy - The fit policy
+ * probes - The number of blocks a good fit search looks at. 0 or less 
+ *          selects GOOD_FIT_PROBES
+ */
+void mm_set_fit_policy(mm_fit_policy_t policy, int probes)
+{
+    fit_policy = policy;
+    good_fit_probes = (probes > 0) ? probes : GOOD_FIT_PROBES;
+}
+
+/*
+ * Sets the size that the free block at the end of the heap must reach 
+ * before trim_heap gives it back to memlib
+ * 
+ * Input:
+ * threshold - The size in bytes, or 0 to never shrink the heap
+ */
+void mm_set_trim_threshold(size_t threshold)
+{
+    trim_threshold = threshold;
+}
+
+/*
+ * Sets the request size from which mm_malloc maps a region for the block
+ * instead of taking it from the heap
+ * 
+ * Input:
+ * threshold - The size in bytes, or 0 to never map a region
+ */
+void mm_set_mmap_threshold(size_t threshold)
+{
+    mmap_threshold = threshold;
+}
+
+/*
+ * Sets how long a large free block stays untouched before purge_arena 
+ * gives its pages back to the system. The time is counted in the frees 
+ * that reach its arena (the thread caches do not count).
+ * 
+ * Input:
+ * decay - The number of frees, or 0 to never purge
+ */
+void mm_set_purge_decay(unsigned int decay)
+{
+    purge_decay = decay;
+}
+
+/*
+ * Gets the counters of the allocator since the last mm_init, summed over 
+ * all arenas
+ * 
+ * Input:
+ * stats - Where the counters are stored
+ */
+void mm_get_stats(mm_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+
+    for(int n = 0; n < NUM_ARENAS; n++) {
+        arena_t *a = &ctx->arenas[n];
+
+        LOCK(&a->lock);
+        stats->quick_lookups += a->stats.quick_lookups;
+        stats->quick_hits += a->stats.quick_hits;
+        stats->consolidations += a->stats.consolidations;
+        stats->reallocs += a->stats.reallocs;
+        stats->realloc_moves += a->stats.realloc_moves;
+        stats->bytes_copied += a->stats.bytes_copied;
+        stats->trims += a->stats.trims;
+        stats->extensions += a->stats.extensions;
+        stats->purges += a->stats.purges;
+        stats->bytes_purged += a->stats.bytes_purged;
+        UNLOCK(&a->lock);
+    }
+}
+
+/*
+ * Resizes a block for mm_realloc and keeps track of blocks that grow again
+ * and again. Once a block has grown GROW_STREAK times in a row it is given
+ * geometric headroom: when it cannot grow in place, it is moved to a block
+ * of GROW_RESERVE bytes, so the next growths need no copy. The headroom is
+ * only a soft reservation, as reclaim_headroom gives it back when a malloc
+ * would otherwise have to extend the heap. A growth that still fits in the
+ * headroom leaves the block as it is. Growing at the heap top needs no
+ * copy, so no headroom is reserved there.
+ * 
+ * Inputs:
+ * a - The arena of the block
+ * ptr - The pointer to the block of memory to resize
+ * size - The new size of the payload
+ * 
+ * Returns:
+ * The block that now holds the new size, or NULL if mm_realloc has to move it
+ */
+static void *realloc_block(arena_t *a, void *ptr, size_t size)
+{
+    size_t asize = adjust_size(size);
+    int headroom = ptr == a->grow_block;
+    // A block with headroom grows as long as it passes the size it was last grown to
+    size_t last_size = headroom ? a->grow_size : GET_SIZE(HDRP(ptr));
+    int grows = get_slab_run(ptr) == NULL && last_size < asize;
+    unsigned int streak = headroom ? a->grow_count + 1 : 1;
+
+    // The headroom of the block is not taken back while it is resized
+    if(headroom)
+        a->grow_block = NULL;
+
+    int reserve = grows && asize > QUICK_MAX_SIZE && streak >= GROW_STREAK;
+
+    a->stats.reallocs++;
+
+    void *bp;
+
+    // A growth into the headroom keeps the rest of it, which only
+    // reclaim_headroom gives back
+    if(headroom && grows && GET_SIZE(HDRP(ptr)) >= asize)
+        bp = ptr;
+    else
+        bp = resize_block(a, ptr, size);
+
+    // Move the block to a block with headroom in the same arena
+    if(bp == NULL && reserve && (bp = malloc_block(a, GROW_RESERVE(asize))) != NULL) {
+        size_t copy_size = GET_SIZE(HDRP(ptr)) - WSIZE; // The whole old payload fits
+
+        memcpy(bp, ptr, copy_size);
+        arena_free(a, ptr, 0);
+        a->stats.realloc_moves++;
+        a->stats.bytes_copied += copy_size;
+    }
+
+    // When bp is NULL, mm_realloc copies the block and counts the move
+    if(bp != NULL && grows && asize > QUICK_MAX_SIZE) {
+        a->grow_block = bp;
+        a->grow_size = asize;
+        a->grow_count = streak;
+    }
+
+    return bp;
+}
+
+/*
+ * Gives the headroom of the block that realloc_block reserved it for back 
+ * to the free lists
+ * 
+ * Input:
+ * a - The arena
+ * 
+ * Returns:
+ * 1 if any memory was freed, otherwise 0
+ */
+static int reclaim_headroom(arena_t *a)
+{
+    char *bp = a->grow_block;
+
+    if(bp == NULL || GET_SIZE(HDRP(bp)) < a->grow_size + MIN_BLOCK_SIZE)
+        return 0;
+
+    shrink_block(a, bp, a->grow_size);
+    a->grow_block = NULL;
+
+    return 1;
+}
+
+/*
+ * Resizes the block in place if the new size fits in it or if it can be
+ * extended into its free neighbours. The right neighbour is tried first
+ * and then the end of the heap, since neither needs the payload to be 
+ * moved. Only when the left neighbour is needed the payload is moved down
+ * with memmove. A block that grows keeps all of its neighbours as room for
+ * the next growth, but a block that shrinks gives its tail back to the 
+ * free lists.
+ * 
+ * Inputs:
+ * a - The arena of the block
+ * ptr - The pointer to the block of memory to resize
+ * size - The new size of the payload
+ * 
+ * Returns:
+ * The block that now holds the new size, or NULL if it has to be moved
+ */
+static void *resize_block(arena_t *a, void *ptr, size_t size)
+{
+    // A slot can only be kept if the new size fits in the slot
+    slab_run_t *run = get_slab_run(ptr);
+    if(run != NULL)
+        return (size <= run->slot_size) ? ptr : NULL;
+
+    size_t aligned_size = adjust_size(size);
+    size_t old_size = GET_SIZE(HDRP(ptr));
+
+    if(old_size >= aligned_size) {
+        shrink_block(a, ptr, aligned_size); // The block is kept and the rest is freed
+        return ptr;
+    }
+
+    void *old_next_ptr = NEXT_BLKP(ptr);
+    size_t old_next_size = GET_SIZE(HDRP(old_next_ptr));
+    size_t next_free = GET_ALLOC(HDRP(old_next_ptr)) ? 0 : old_next_size;
+    
+    // If the next block is not alloacted and that the size is bigger then the requested size
+    if(next_free && (old_size+old_next_size) >= aligned_size) {
+
+        size_t new_size = old_size + old_next_size;
+        int wilderness = old_next_ptr == a->wilderness;
+
+        remove_free_block(a, old_next_ptr); // Remove the free block from free list
+
+        PUT(HDRP(ptr), PACK(new_size, (GET(HDRP(ptr)) & (PREV_ALLOC | SMALL)) | ALLOC));
+        SET_PREV_ALLOC(HDRP(NEXT_BLKP(ptr)));
+
+        // Only the bytes that are needed are taken from the wilderness
+        if(wilderness)
+            shrink_block(a, ptr, aligned_size);
+
+        return ptr;
+    } 
+
+    // The block (or its free right neighbour) is the last one of the heap,
+    // so the heap is extended by the missing bytes and the block grows into them
+    char *end = next_free ? NEXT_BLKP(old_next_ptr) : old_next_ptr;
+    if(end == a->heap_end && is_heap_top(end)) {
+        if(extend_wilderness(a, aligned_size - old_size - next_free) == NULL)
+            return NULL;
+
+        return resize_block(a, ptr, size);
+    }
+
+    // The left neighbour is free, so the payload is moved down into it
+    if(!GET_PREV_ALLOC(HDRP(ptr))) {
+        char *prev = PREV_BLKP(ptr);
+        size_t new_size = GET_SIZE(HDRP(prev)) + old_size + next_free;
+
+        if(new_size >= aligned_size) {
+            unsigned int small = GET(HDRP(ptr)) & SMALL;
+
+            remove_free_block(a, prev);
+            if(next_free)
+                remove_free_block(a, old_next_ptr);
+
+            memmove(prev, ptr, old_size - WSIZE);
+            a->stats.bytes_copied += old_size - WSIZE;
+
+            // The block left of a free block is always allocated
+            PUT(HDRP(prev), PACK(new_size, PREV_ALLOC | small | ALLOC));
+            SET_PREV_ALLOC(HDRP(NEXT_BLKP(prev)));
+
+            return prev;
+        }
+    }
+
+    // The next block may be waiting in a quick list, so coalesce those and try again
+    if(GET_ALLOC(HDRP(old_next_ptr)) && old_next_size <= QUICK_MAX_SIZE && consolidate(a))
+        return resize_block(a, ptr, size);
+
+    return NULL;
+}
+
+/*
+ * Splits the tail off an allocated block and frees it, the same way as 
+ * 'place' splits a free block. The tail is coalesced with a free right 
+ * neighbour. Nothing is split off if the tail is smaller than a block.
+ * 
+ * Inputs:
+ * a - The arena of the block
+ * bp - The allocated block
+ * asize - The size the block is shrunk to
+*/
+static void shrink_block(arena_t *a, void *bp, size_t asize) {
+    size_t size = GET_SIZE(HDRP(bp));
+    size_t size_diff = size - asize;
+
+    if(size_diff < MIN_BLOCK_SIZE)
+        return;
+
+    PUT(HDRP(bp), PACK(asize, GET(HDRP(bp)) & (PREV_ALLOC | SMALL | ALLOC)));
+
+    void *split_p = NEXT_BLKP(bp);
+    PUT(HDRP(split_p), PACK(size_diff, PREV_ALLOC));
+    PUT(FTRP(split_p), PACK(size_diff, 0));
+    CLEAR_PREV_ALLOC(HDRP(NEXT_BLKP(split_p)));
+    insert_free_block(a, split_p);
+}
+
+/*
+ * Gets the number of bytes that the user can store in a block
+ * 
+ * Input:
+ * bp - A block or slab slot returned by mm_malloc
+ * 
+ * Returns:
+ * The size of the slot or the payload of the block
+ */
+static size_t usable_size(void *bp)
+{
+    if(IS_MAPPED(bp))
+        return MAP_SIZE(bp) - MAP_OFFSET;
+
+    slab_run_t *run = get_slab_run(bp);
+
+    if(run != NULL)
+        return run->slot_size;
+
+    return GET_SIZE(HDRP(bp)) - WSIZE; // The payload is everything but the header
+}
+
+/*
+ * Coalesces the bp and inserts the resulting_bp into the segregated free list
+ *
+ * Input:
+ * A free block to be inserted
+ * 
+ * Returns:
+ * The free block coalesced
+*/
+static void *insert_free_block(arena_t *a, void *bp) {
+
+    void *result_bp = coalesce(a, bp);
+    size_t size = GET_SIZE(HDRP(result_bp));
+    int index = get_free_list_index(size);
+
+    // A free block that ends the arena's heap is its wilderness. A large
+    // one is stamped like a node of the tree, so that it is purged as well
+    if(NEXT_BLKP(result_bp) == a->heap_end) {
+        a->wilderness = result_bp;
+        if(size >= PURGE_MIN_SIZE) {
+            PUT(FREED_AT(result_bp), a->purge_clock);
+            PUT(PURGED(result_bp), 0);
+        }
+        return result_bp;
+    }
+
+    if(IS_TREE(index)) {
+
+        // The decay of a large block starts now, even if it held purged pages
+        if(index == TREE_INDEX) {
+            PUT(FREED_AT(result_bp), a->purge_clock);
+            PUT(PURGED(result_bp), 0);
+        }
+
+        a->free_lists[index] = tree_insert(a->free_lists[index], result_bp, index);
+        MAP_SET(a, index);
+        return result_bp;
+    }
+
+    // The lists are LIFO, so the new block becomes the top of the list
+    char *next = a->free_lists[index];
+
+    SET_FREE_P(PREV_FRBP(result_bp), NULL);
+    SET_FREE_P(NEXT_FRBP(result_bp), next);
+
+    if(next != NULL)
+        SET_FREE_P(PREV_FRBP(next), result_bp);
+
+    a->free_lists[index] = result_bp;
+    MAP_SET(a, index);
+
+    return result_bp;
+}
+
+/*
+ * Remove the block from the free list and binds the surounding free block together
+ *
+ * Input:
+ * bp - The free block to be removed from the free list
+*/
+static void remove_free_block(arena_t *a, void *bp) {
+
+    // The wilderness is in no list
+    if(bp == a->wilderness) {
+        a->wilderness = NULL;
+        return;
+    }
+
+    size_t size = GET_SIZE(HDRP(bp));
+    int free_list_index = get_free_list_index(size);
+
+    if(IS_TREE(free_list_index)) {
+        a->free_lists[free_list_index] = tree_remove(a->free_lists[free_list_index], bp, free_list_index);
+
+        if(a->free_lists[free_list_index] == NULL)
+            MAP_CLEAR(a, free_list_index);
+        return;
+    }
+
+    void *next = NEXT_FREE_BLOCK(bp);
+    void *prev = PREV_FREE_BLOCK(bp);
+
+    // Remove previous block pointer refs
+    SET_FREE_P(NEXT_FRBP(bp), NULL);
+    SET_FREE_P(PREV_FRBP(bp), NULL); 
+
+    /* 
+    *   If the current block(that is going to be removed) 
+    *   then set beginning of free_listp to the next pointer 
+    */
+    if(bp == a->free_lists[free_list_index]) {
+        a->free_lists[free_list_index] = next;
+
+        // The list became empty so clear it in the bitmap
+        if(next == NULL)
+            MAP_CLEAR(a, free_list_index);
+    }
+
+    if(next != NULL && prev != NULL) {
+
+        SET_FREE_P(NEXT_FRBP(prev), next);
+        SET_FREE_P(PREV_FRBP(next), prev);
+    } else if (next != NULL && prev == NULL) {
+
+        SET_FREE_P(PREV_FRBP(next), NULL);
+    } else if (next == NULL && prev != NULL) {
+
+        SET_FREE_P(NEXT_FRBP(prev), NULL);     
+    }
+
+}
+
+/*
+ * Inserts a free block into a tree. The block goes down in the order of the
+ * tree until it meets a node with a lower priority. That subtree is split 
+ * into the nodes before and after the block, which become its left and 
+ * right subtrees.
+ * 
+ * Inputs:
+ * root - The root of the tree or subtree
+ * bp - The free block to be inserted
+ * index - The size class of the tree
+ * 
+ * Returns:
+ * The new root of the subtree
+*/
+static char *tree_insert(char *root, char *bp, int index) {
+
+    if(root == NULL || TREE_PRIORITY(bp) > TREE_PRIORITY(root)) {
+        char *left, *right;
+
+        tree_split(root, bp, index, &left, &right);
+        SET_LEFT_CHILD(bp, left);
+        SET_RIGHT_CHILD(bp, right);
+        root = bp;
+    } else if(TREE_LESS(bp, root))
+        SET_LEFT_CHILD(root, tree_insert(LEFT_CHILD(root), bp, index));
+    else
+        SET_RIGHT_CHILD(root, tree_insert(RIGHT_CHILD(root), bp, index));
+
+    tree_update(root, index);
+    return root;
+}
+
+/*
+ * Removes a free block from a tree. Its two subtrees are merged into one 
+ * that takes its place.
+ * 
+ * Inputs:
+ * root - The root of the tree or subtree that holds the block
+ * bp - The free block to be removed
+ * index - The size class of the tree
+ * 
+ * Returns:
+ * The new root of the subtree
+*/
+static char *tree_remove(char *root, char *bp, int index) {
+
+    if(root == bp)
+        return tree_merge(LEFT_CHILD(bp), RIGHT_CHILD(bp), index);
+
+    if(TREE_LESS(bp, root))
+        SET_LEFT_CHILD(root, tree_remove(LEFT_CHILD(root), bp, index));
+    else
+        SET_RIGHT_CHILD(root, tree_remove(RIGHT_CHILD(root), bp, index));
+
+    tree_update(root, index);
+    return root;
+}
+
+/*
+ * Splits a subtree into the nodes that go before a block and the nodes that
+ * go after it
+ * 
+ * Inputs:
+ * root - The root of the subtree
+ * bp - The block to split at, which is not in the subtree
+ * index - The size class of the tree
+ * left - Receives the subtree of the nodes before the block
+ * right - Receives the subtree of the nodes after the block
+*/
+static void tree_split(char *root, char *bp, int index, char **left, char **right) {
+
+    char *rest;
+
+    if(root == NULL) {
+        *left = *right = NULL;
+        return;
+    }
+
+    if(TREE_LESS(root, bp)) {
+        tree_split(RIGHT_CHILD(root), bp, index, &rest, right);
+        SET_RIGHT_CHILD(root, rest);
+        *left = root;
+    } else {
+        tree_split(LEFT_CHILD(root), bp, index, left, &rest);
+        SET_LEFT_CHILD(root, rest);
+        *right = root;
+    }
+
+    tree_update(root, index);
+}
+
+/*
+ * Merges two subtrees, where every node of the left one goes before the
+ * nodes of the right one. Going down the facing spines of the subtrees, the
+ * node with the higher priority is always linked next.
+ * 
+ * Inputs:
+ * left - The subtree of the lower nodes
+ * right - The subtree of the higher nodes
+ * index - The size class of the tree
+ * 
+ * Returns:
+ * The root of the merged subtree
+*/
+static char *tree_merge(char *left, char *right, int index) {
+
+    if(left == NULL || right == NULL)
+        return (left != NULL) ? left : right;
+
+    if(TREE_PRIORITY(left) > TREE_PRIORITY(right)) {
+        SET_RIGHT_CHILD(left, tree_merge(RIGHT_CHILD(left), right, index));
+        tree_update(left, index);
+        return left;
+    }
+
+    SET_LEFT_CHILD(right, tree_merge(left, LEFT_CHILD(right), index));
+    tree_update(right, index);
+    return right;
+}
+
+/*
+ * Recomputes the largest block in the subtree of a node from its children,
+ * if the tree keeps it
+ * 
+ * Inputs:
+ * bp - The node whose children changed
+ * index - The size class of the tree
+*/
+static void tree_update(char *bp, int index) {
+
+    if(!HAS_TREE_MAX(index))
+        return;
+
+    unsigned int max = GET_SIZE(HDRP(bp));
+    char *left = LEFT_CHILD(bp);
+    char *right = RIGHT_CHILD(bp);
+
+    if(left != NULL)
+        max = MAX(max, GET(TREE_MAX(left)));
+    if(right != NULL)
+        max = MAX(max, GET(TREE_MAX(right)));
+
+    PUT(TREE_MAX(bp), max);
+}
+
+/*
+ * Finds the smallest block in a tree ordered by size that fits the size. 
+ * Among blocks of the same size the one with the lowest address is taken.
+ * Good fit stops after 'good_fit_probes' nodes from the first block that 
+ * fits on, and takes the smallest of those.
+ * 
+ * Inputs:
+ * root - The root of the tree
+ * size - The size the block of memory should have
+ * 
+ * Returns:
+ * The best fitting block or NULL if no block in the tree fits
+*/
+static char *tree_find_fit(char *root, size_t size) {
+
+    char *fit = NULL;
+    int probes = (fit_policy == MM_FIT_GOOD) ? good_fit_probes : -1;
+
+    while(root != NULL && probes != 0) {
+
+        // A fitting block is a candidate, but a smaller one may be on the left
+        if(GET_SIZE(HDRP(root)) >= size) {
+            fit = root;
+            root = LEFT_CHILD(root);
+        } else
+            root = RIGHT_CHILD(root);
+
+        if(fit != NULL && probes > 0)
+            probes--;
+    }
+
+    return fit;
+}
+
+/*
+ * Finds the lowest addressed block in an address ordered tree that fits the
+ * size. The largest block of each subtree tells which way to go down.
+ * 
+ * Inputs:
+ * root - The root of the tree
+ * size - The size the block of memory should have
+ * 
+ * Returns:
+ * The first fitting block or NULL if no block in the tree fits
+*/
+static char *tree_find_first_fit(char *root, size_t size) {
+
+    if(root == NULL || GET(TREE_MAX(root)) < size)
+        return NULL;
+
+    // The subtree of root always holds a block that fits
+    while(1) {
+        char *left = LEFT_CHILD(root);
+
+        if(left != NULL && GET(TREE_MAX(left)) >= size)
+            root = left;
+        else if(GET_SIZE(HDRP(root)) >= size)
+            return root;
+        else
+            root = RIGHT_CHILD(root);
+    }
+}
+
+/*
+ * Adjusts the requested size to a block size that includes the header and
+ * satisfies the alignment. The block must also be large enough to hold the
+ * free list pointers and footer once it is freed.
+ *
+ * Input:
+ * size - The size requested by the user of the allocator
+ * 
+ * Returns:
+ * The size of the block
+*/
+static size_t adjust_size(size_t size) {
+
+    return MAX(ALIGN(size + WSIZE), MIN_BLOCK_SIZE);
+}
+
+/*
+ * Gets the index that the size should be in
+ *
+ * Sizes up to MAX_EXACT_SIZE map to one list per 8 bytes. Above that the
+ * range (2^p, 2^(p+1)] is split into 4 lists of equal width, and every
+ * size beyond the last range (above 1024 bytes) goes into the tree.
+ *
+ * Input:
+ * size - The size that the list should be able to hold
+ * 
+ * Returns:
+ * The index of the free list
+*/
+static int get_free_list_index(size_t size) { 
+
+    if (size <= MAX_EXACT_SIZE)
+        return (size / DSIZE) - 2;
+
+    // Find the power of two range and the sub list inside of it
+    unsigned int rounded = size - 1;
+    int p = 31 - __builtin_clz(rounded);
+    int sub = (rounded >> (p - SUB_LISTS_LOG2)) & ((1 << SUB_LISTS_LOG2) - 1);
+    int index = NUM_EXACT_LISTS + ((p - 7) << SUB_LISTS_LOG2) + sub;
+
+    return index < NUM_FREE_LISTS ? index : NUM_FREE_LISTS - 1;
+}
+
+/*
+ * Finds the first payload address inside a free block that is aligned to the
+ * given alignment (relative to a base address) and leaves room for a free 
+ * block in front of it.
+ * 
+ * Inputs:
+ * bp - The free block
+ * align - The alignment of the payload. Must be a power of two
+ * base - The address the alignment is relative to, NULL for absolute addresses
+ * 
+ * Returns:
+ * The aligned payload address, which may lie beyond the end of the block
+*/
+static char *align_payload(char *bp, size_t align, char *base) {
+
+    unsigned long offset = (unsigned long)bp - (unsigned long)base;
+    char *aligned_bp = bp + (-offset & (align - 1));
+
+    while(aligned_bp != bp && aligned_bp - bp < MIN_BLOCK_SIZE)
+        aligned_bp += align;
+
+    return aligned_bp;
+}
+
+/*
+ * Allocates an ordinary block whose payload is aligned to the given alignment
+ * (relative to a base address). The free block found for the size is
+ * used if an aligned payload fits in it, otherwise a block that is large 
+ * enough for any position of the payload is taken. The gap in front of the
+ * payload is split off as a free block of its own.
+ * 
+ * Inputs:
+ * asize - The adjusted size of the block
+ * align - The alignment of the payload. Must be a power of two
+ * base - The address the alignment is relative to, NULL for absolute addresses
+ * 
+ * Returns:
+ * The aligned block or NULL if the heap cannot be extended
+*/
+static void *malloc_aligned_block(arena_t *a, size_t asize, size_t align, char *base) {
+
+    // Leave room for a gap which is at least a minimum sized free block
+    size_t search_size = asize + align + MIN_BLOCK_SIZE;
+    char *bp = find_fit(a, asize);
+
+    if(bp == NULL || align_payload(bp, align, base) + asize > (char *)bp + GET_SIZE(HDRP(bp)))
+        bp = find_fit(a, search_size);
+
+    if(bp == NULL && consolidate(a))
+        bp = find_fit(a, search_size);
+
+    if(bp != NULL)
+        remove_free_block(a, bp);
+    else if((bp = take_wilderness(a, search_size)) == NULL)
+        return NULL;
+
+    char *aligned_bp = align_payload(bp, align, base);
+
+    if(aligned_bp != bp) {
+        size_t gap = aligned_bp - bp;
+        size_t size = GET_SIZE(HDRP(bp));
+
+        // The aligned block is marked allocated so the gap is not coalesced with it
+        PUT(HDRP(aligned_bp), PACK(size - gap, ALLOC));
+        PUT(HDRP(bp), PACK(gap, GET_PREV_ALLOC(HDRP(bp))));
+        PUT(FTRP(bp), PACK(gap, 0));
+        insert_free_block(a, bp);
+    }
+
+    allocate_block(a, aligned_bp, asize);
+    return aligned_bp;
+}
+
+/****************************************
+************* QUICK LISTS ***************
+****************************************/
+
+/*
+ * Keeps a freed block in the quick list of its size. The block stays marked
+ * as allocated, so its neighbours do not coalesce with it. A block that is
+ * larger than the size only serves requests of that size until the lists
+ * are consolidated. The header is not read, so that a sized free does not
+ * wait for it; a SMALL block is only counted as dead once it leaves the
+ * quick list (quick_get or consolidate).
+ * 
+ * Inputs:
+ * a - The arena of the block
+ * bp - The block being freed
+ * size - The size of the block, or a smaller size that picks the list
+ * 
+ * Returns:
+ * 1 if the block was put in a quick list, 0 if it is too large
+*/
+static int quick_put(arena_t *a, void *bp, size_t size) {
+
+    if(size > QUICK_MAX_SIZE)
+        return 0;
+
+    SET_QUICK_NEXT(bp, a->quick_lists[QUICK_INDEX(size)]);
+    a->quick_lists[QUICK_INDEX(size)] = bp;
+    a->quick_blocks++;
+
+    return 1;
+}
+
+/*
+ * Takes a block of exactly the given size from its quick list
+ * 
+ * Inputs:
+ * a - The arena to allocate from
+ * asize - The adjusted size of the block
+ * 
+ * Returns:
+ * The block, which is already marked as allocated, or NULL if the quick 
+ * list is empty or the size has none
+*/
+static void *quick_get(arena_t *a, size_t asize) {
+
+    if(asize > QUICK_MAX_SIZE)
+        return NULL;
+
+    a->stats.quick_lookups++;
+
+    char *bp = a->quick_lists[QUICK_INDEX(asize)];
+
+    if(bp == NULL)
+        return NULL;
+
+    a->quick_lists[QUICK_INDEX(asize)] = QUICK_NEXT(bp);
+    a->quick_blocks--;
+    a->stats.quick_hits++;
+
+    // The block no longer holds the small object it was freed with
+    unsigned int header = GET(HDRP(bp));
+    if(header & SMALL) {
+        a->small_live--;
+        PUT(HDRP(bp), header & ~SMALL);
+    }
+
+    return bp;
+}
+
+/*
+ * Frees every block of the quick lists for real, so that they coalesce 
+ * with their free neighbours and can be used for requests of any size
+ * 
+ * Input:
+ * a - The arena to consolidate
+ * 
+ * Returns:
+ * 1 if any block was freed, 0 if the quick lists were empty
+*/
+static int consolidate(arena_t *a) {
+
+    if(a->quick_blocks == 0)
+        return 0;
+
+    for(int i = 0; i < NUM_QUICK_LISTS; i++) {
+        char *bp = a->quick_lists[i];
+
+        while(bp != NULL) {
+            char *next = QUICK_NEXT(bp);
+            free_block(a, bp);
+            bp = next;
+        }
+
+        a->quick_lists[i] = NULL;
+    }
+
+    a->quick_blocks = 0;
+    a->stats.consolidations++;
+
+    return 1;
+}
+
+/****************************************
+*************** PURGING *****************
+****************************************/
+
+/*
+ * Gives the pages of the large free blocks, the wilderness included, that
+ * have stayed free for 'purge_decay' frees back to the system. It runs every quarter of the 
+ * decay from arena_free, so a block is purged at most a quarter of the 
+ * decay late, and the malloc path never purges. The arena must be locked.
+ * 
+ * Input:
+ * a - The arena to purge
+*/
+static void purge_arena(arena_t *a) {
+
+    a->purge_countdown = PURGE_INTERVAL(purge_decay);
+    purge_tree(a, a->free_lists[TREE_INDEX]);
+
+    if(a->wilderness != NULL && GET_SIZE(HDRP(a->wilderness)) >= PURGE_MIN_SIZE)
+        purge_block(a, a->wilderness);
+}
+
+/*
+ * Purges the blocks of a subtree of the tree of large blocks.
+ * 
+ * Inputs:
+ * a - The arena of the tree
+ * bp - The root of the subtree
+*/
+static void purge_tree(arena_t *a, char *bp) {
+
+    while(bp != NULL) {
+
+        // A tree by address knows the largest block below a node. In a tree by
+        // size the left subtree holds smaller blocks, so it is only searched if
+        // this one is large
+        if(HAS_TREE_MAX(TREE_INDEX)) {
+            if(GET(TREE_MAX(bp)) < PURGE_MIN_SIZE)
+                return;
+        } else if(GET_SIZE(HDRP(bp)) < PURGE_MIN_SIZE) {
+            bp = RIGHT_CHILD(bp);
+            continue;
+        }
+        purge_tree(a, LEFT_CHILD(bp));
+        if(GET_SIZE(HDRP(bp)) >= PURGE_MIN_SIZE)
+            purge_block(a, bp);
+        bp = RIGHT_CHILD(bp);
+    }
+}
+
+/*
+ * Purges a large free block if it has stayed free long enough. Only the 
+ * page aligned interior of the block is given back, so its header, child 
+ * links, stamps, largest size (TREE_MAX) and footer stay. The pages read as zeros when the block is
+ * allocated again.
+ * 
+ * Inputs:
+ * a - The arena of the block
+ * bp - The stamped free block
+*/
+static void purge_block(arena_t *a, char *bp) {
+
+    size_t page = mem_pagesize();
+
+    if(GET(PURGED(bp)) || a->purge_clock - GET(FREED_AT(bp)) < purge_decay)
+        return;
+
+    char *lo = (char *)(((unsigned long)NODE_END(bp) + page - 1) & ~(page - 1));
+    char *hi = (char *)((unsigned long)FTRP(bp) & ~(page - 1));
+
+    if(hi > lo) {
+        LOCK(&ctx->heap_lock);
+        a->stats.bytes_purged += mem_purge_h(ctx->heap, lo, hi - lo);
+        UNLOCK(&ctx->heap_lock);
+        a->stats.purges++;
+    }
+    PUT(PURGED(bp), 1);
+}
+
+/****************************************
+*************** BATCHES *****************
+****************************************/
+
+/*
+ * Allocates n objects of the same size under a single lock. Ordinary 
+ * blocks are carved one after the other from a single free block that 
+ * fits all of them, so the free lists are searched only once.
+ * 
+ * Inputs:
+ * size - The requested size of every object
+ * n - The number of objects
+ * out - The array that receives the pointers
+ * 
+ * Returns:
+ * The number of objects allocated, which is less than n only if the heap
+ * is full
+*/
+int mm_malloc_batch(size_t size, int n, void **out)
+{
+    int count = 0;
+
+    if (size == 0 || n <= 0)
+        return 0;
+
+    /* Huge requests get a region of their own each */
+    if (mmap_threshold != 0 && size >= mmap_threshold) {
+        while (count < n && (out[count] = map_malloc(size)) != NULL)
+            count++;
+        return count;
+    }
+
+    arena_t *a = get_thread_arena();
+    LOCK(&a->lock);
+
+#ifdef MM_THREADS
+    if (__atomic_load_n(&a->remote_frees, __ATOMIC_RELAXED) != NULL)
+        drain_remote_frees(a);
+#endif
+
+    if (size <= SLAB_MAX_SIZE) {
+        while (count < n && (out[count] = small_malloc(a, size)) != NULL)
+            count++;
+    } else {
+        size_t asize = adjust_size(size);
+
+        // Without a free block for the whole batch, the objects are 
+        // allocated one by one, which may use the quick lists
+        if ((count = carve_blocks(a, asize, n, out)) == 0)
+            while (count < n && (out[count] = malloc_block(a, asize)) != NULL)
+                count++;
+    }
+
+    UNLOCK(&a->lock);
+    return count;
+}
+
+/*
+ * Carves n blocks of the same size from one free block. Only a free block
+ * or a wilderness that is large enough already is used, so the heap is
+ * not extended for the batch as a whole.
+ * 
+ * Inputs:
+ * a - The arena
+ * asize - The adjusted size of every block
+ * n - The number of blocks
+ * out - The array that receives the blocks
+ * 
+ * Returns:
+ * n, or 0 if no free block fits the batch
+*/
+static int carve_blocks(arena_t *a, size_t asize, int n, void **out) {
+
+    size_t total = asize * n;
+    char *bp;
+
+    if ((bp = find_fit(a, total)) != NULL)
+        remove_free_block(a, bp);
+    else if (a->wilderness != NULL && GET_SIZE(HDRP(a->wilderness)) >= total)
+        bp = take_wilderness(a, total);
+    else
+        return 0;
+
+    size_t size = GET_SIZE(HDRP(bp));
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+
+    // Every block but the last follows an allocated block, and its
+    // successor is allocated too, so no footer or flag needs fixing
+    for (int i = 0; i < n - 1; i++) {
+        PUT(HDRP(bp), PACK(asize, prev_alloc | ALLOC));
+        out[i] = bp;
+        bp = NEXT_BLKP(bp);
+        size -= asize;
+        prev_alloc = PREV_ALLOC;
+    }
+
+    // The last block takes the rest, which is split off as usual
+    PUT(HDRP(bp), PACK(size, prev_alloc));
+    allocate_block(a, bp, asize);
+    out[n - 1] = bp;
+
+    return n;
+}
+
+/*
+ * Frees n blocks. The pointers are sorted by address first, so blocks that
+ * lie next to each other are merged and coalesced in one sweep instead of
+ * one at a time. NULL pointers are ignored.
+ * 
+ * Inputs:
+ * ptrs - The blocks to free. The array is sorted in place
+ * n - The number of blocks
+*/
+void mm_free_batch(void **ptrs, int n)
+{
+    arena_t *locked = NULL;
+    int i = 0;
+
+    if (n <= 0)
+        return;
+
+    qsort(ptrs, n, sizeof(void *), compare_pointers);
+
+    while (i < n) {
+        void *bp = ptrs[i];
+
+        if (bp == NULL) {
+            i++;
+            continue;
+        }
+
+        if (IS_MAPPED(bp)) {
+            map_free(bp);
+            i++;
+            continue;
+        }
+
+        // Blocks of foreign arenas are freed under the lock of their arena
+        arena_t *a = get_block_arena(bp);
+        if (a != locked) {
+            if (locked != NULL)
+                UNLOCK(&locked->lock);
+            LOCK(&a->lock);
+            locked = a;
+        }
+
+        i += free_adjacent(a, ptrs + i, n - i);
+    }
+
+    if (locked != NULL)
+        UNLOCK(&locked->lock);
+}
+
+/*
+ * Frees the first of the sorted blocks together with the blocks that 
+ * directly follow it in the heap. They are merged into one block before
+ * it is freed, so the run coalesces with its neighbours only once.
+ * 
+ * Inputs:
+ * a - The arena of the blocks
+ * ptrs - The sorted blocks, the first of which is freed
+ * n - The number of blocks in the array
+ * 
+ * Returns:
+ * The number of blocks that were freed
+*/
+static int free_adjacent(arena_t *a, void **ptrs, int n) {
+
+    char *bp = ptrs[0];
+    char *end = NEXT_BLKP(bp);
+    int count = 1;
+
+    // Slab slots are no blocks of their own
+    if (get_slab_run(bp) != NULL) {
+        arena_free(a, bp, 0);
+        return 1;
+    }
+
+    while (count < n && ptrs[count] == end && get_slab_run(end) == NULL) {
+        end = NEXT_BLKP(end);
+        count++;
+    }
+
+    // A single block may as well wait in a quick list
+    if (count == 1) {
+        arena_free(a, bp, 0);
+        return 1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (ptrs[i] == a->grow_block)
+            a->grow_block = NULL;
+        if (GET(HDRP(ptrs[i])) & SMALL)
+            a->small_live--;
+    }
+
+    PUT(HDRP(bp), PACK(end - bp, GET_PREV_ALLOC(HDRP(bp)) | ALLOC));
+
+    bp = free_block(a, bp);
+    if (GET_SIZE(HDRP(bp)) >= CONSOLIDATE_SIZE)
+        consolidate(a);
+
+    return count;
+}
+
+/*
+ * Orders two pointers by address for qsort
+*/
+static int compare_pointers(const void *p, const void *q) {
+
+    char *x = *(char **)p;
+    char *y = *(char **)q;
+
+    return (x > y) - (x < y);
+}
+
+/****************************************
+************ MAPPED BLOCKS **************
+****************************************/
+
+/*
+ * Allocates a block in a region of its own
+ *
+ * Input:
+ * size - The size of the payload
+ *
+ * Returns:
+ * The payload of the block, or NULL if no region could be mapped
+*/
+static void *map_malloc(size_t size) {
+    size_t page = mem_pagesize();
+
+    if(size > SIZE_MAX - MAP_OFFSET - page)
+        return NULL;
+
+    size_t msize = (size + MAP_OFFSET + page - 1) / page * page;
+
+    // memlib is not thread-safe, so regions are mapped under the heap lock
+    LOCK(&ctx->heap_lock);
+    char *region = mem_map_h(ctx->heap, msize);
+    UNLOCK(&ctx->heap_lock);
+
+    if(region == NULL)
+        return NULL;
+
+    char *bp = region + MAP_OFFSET;
+    MAP_SIZE(bp) = msize;
+    return bp;
+}
+
+/*
+ * Gives the region of a mapped block back to memlib
+ *
+ * Input:
+ * bp - The payload of the block
+*/
+static void map_free(void *bp) {
+
+    LOCK(&ctx->heap_lock);
+    mem_unmap_h(ctx->heap, (char *)bp - MAP_OFFSET);
+    UNLOCK(&ctx->heap_lock);
+}
+
+/*
+ * Resizes the region of a mapped block. The region may move, but its pages
+ * are moved by memlib without copying them
+ *
+ * Inputs:
+ * bp - The payload of the block
+ * size - The new size of the payload
+ *
+ * Returns:
+ * The payload of the resized block, or NULL if the region could not be resized
+*/
+static void *map_realloc(void *bp, size_t size) {
+    size_t page = mem_pagesize();
+
+    if(size > SIZE_MAX - MAP_OFFSET - page)
+        return NULL;
+
+    size_t msize = (size + MAP_OFFSET + page - 1) / page * page;
+
+    if(msize == MAP_SIZE(bp))
+        return bp;
+
+    LOCK(&ctx->heap_lock);
+    char *region = mem_remap_h(ctx->heap, (char *)bp - MAP_OFFSET, msize);
+    UNLOCK(&ctx->heap_lock);
+
+    if(region == NULL)
+        return NULL;
+
+    bp = region + MAP_OFFSET;
+    MAP_SIZE(bp) = msize;
+    return bp;
+}
+
+/****************************************
+************ SLAB ALLOCATOR *************
+****************************************/
+
+/*
+ * Gets the slab class of a small request
+ *
+ * Input:
+ * size - The requested size. At most SLAB_MAX_SIZE
+ * 
+ * Returns:
+ * The index of the smallest slot size that can hold the request
+*/
+static int get_slab_class(size_t size) {
+
+#if ALIGNMENT == 16
+    return (size + 15) / 16 - 1;
+#else
+    if(size <= 64)
+        return (size + 7) / 8 - 1;
+
+    return 7 + (size - 64 + 15) / 16;
+#endif
+}
+
+/*
+ * Gets the run that a pointer lies in
+ *
+ * Input:
+ * bp - A pointer returned by mm_malloc
+ * 
+ * Returns:
+ * The run if bp is a slot of a slab run, otherwise NULL
+*/
+static slab_run_t *get_slab_run(void *bp) {
+
+    size_t index = RUN_INDEX(bp);
+
+    if(!IS_RUN(index))
+        return NULL;
+
+    return (slab_run_t *)(ctx->heap_base + index * RUN_SIZE);
+}
+
+/*
+ * Adds the run to the front of the runs of its class that have a free slot
+ *
+ * Input:
+ * run - The run to add
+*/
+static void link_run(arena_t *a, slab_run_t *run) {
+
+    slab_run_t *head = a->partial_runs[run->class_index];
+
+    run->prev = NULL;
+    run->next = head;
+
+    if(head != NULL)
+        head->prev = run;
+
+    a->partial_runs[run->class_index] = run;
+}
+
+/*
+ * Removes the run from the runs of its class that have a free slot
+ *
+ * Input:
+ * run - The run to remove
+*/
+static void unlink_run(arena_t *a, slab_run_t *run) {
+
+    if(run->prev != NULL)
+        run->prev->next = run->next;
+    else
+        a->partial_runs[run->class_index] = run->next;
+
+    if(run->next != NULL)
+        run->next->prev = run->prev;
+}
+
+/*
+ * Carves a new run for a slab class out of the heap
+ *
+ * Input:
+ * class_index - The slab class of the run
+ * 
+ * Returns:
+ * The new run with every slot free or NULL if the heap is full
+*/
+static slab_run_t *new_slab_run(arena_t *a, int class_index) {
+
+    slab_run_t *run = malloc_aligned_block(a, adjust_size(RUN_PAYLOAD), RUN_SIZE, ctx->heap_base);
+
+    if(run == NULL)
+        return NULL;
+
+    run->slot_size = slab_class_sizes[class_index];
+    run->num_slots = (RUN_PAYLOAD - RUN_SLOTS_OFFSET) / run->slot_size;
+    run->num_free = run->num_slots;
+    run->class_index = class_index;
+
+    // Mark every slot as free
+    memset(run->free_slots, 0, sizeof(run->free_slots));
+    for(unsigned int i = 0; i < run->num_slots; i++)
+        run->free_slots[i / 32] |= 1U << (i % 32);
+
+    RUN_MAP_SET(RUN_INDEX(run));
+
+    link_run(a, run);
+    return run;
+}
+
+/*
+ * Allocates a small request. It is served by the slabs when enough small
+ * objects are live to make the runs pay off, otherwise by an ordinary block.
+ *
+ * Input:
+ * size - The requested size. At most SLAB_MAX_SIZE
+ * 
+ * Returns:
+ * The pointer to the object or NULL if the heap is full
+*/
+static void *small_malloc(arena_t *a, size_t size) {
+
+    void *bp;
+
+    if(++a->small_live >= SLAB_MIN_LIVE)
+        bp = slab_malloc(a, size);
+    else if((bp = malloc_block(a, adjust_size(size))) != NULL)
+        GET(HDRP(bp)) |= SMALL;
+
+    if(bp == NULL)
+        a->small_live--;
+
+    return bp;
+}
+
+/*
+ * Allocates a slot for a small request
+ *
+ * Input:
+ * size - The requested size. At most SLAB_MAX_SIZE
+ * 
+ * Returns:
+ * The pointer to the slot or NULL if the heap is full
+*/
+static void *slab_malloc(arena_t *a, size_t size) {
+
+    int class_index = get_slab_class(size);
+    slab_run_t *run = a->partial_runs[class_index];
+
+    if(run == NULL && (run = new_slab_run(a, class_index)) == NULL)
+        return NULL;
+
+    // Take the first free slot of the run
+    int word = 0;
+    while(run->free_slots[word] == 0)
+        word++;
+
+    int bit = __builtin_ctz(run->free_slots[word]);
+    run->free_slots[word] &= ~(1U << bit);
+
+    // A full run does not have to be found again until a slot is freed
+    if(--run->num_free == 0)
+        unlink_run(a, run);
+
+    return (char *)run + RUN_SLOTS_OFFSET + (word * 32 + bit) * run->slot_size;
+}
+
+/*
+ * Frees a slot by setting its bit in the run. A run that becomes empty is
+ * given back to the free lists unless it is the only run of its class with
+ * free slots, which avoids creating and releasing a run over and over.
+ *
+ * Inputs:
+ * run - The run that the slot lies in
+ * bp - The slot to free
+*/
+static void slab_free(arena_t *a, slab_run_t *run, void *bp) {
+
+    unsigned int slot = ((char *)bp - (char *)run - RUN_SLOTS_OFFSET) / run->slot_size;
+
+    run->free_slots[slot / 32] |= 1U << (slot % 32);
+    a->small_live--;
+
+    if(run->num_free++ == 0)
+        link_run(a, run);
+
+    if(run->num_free == run->num_slots && (run->prev != NULL || run->next != NULL)) {
+
+        unlink_run(a, run);
+
+        RUN_MAP_CLEAR(RUN_INDEX(run));
+        free_block(a, run);
+    }
+}
+
+/****************************************
+*********** ARENAS AND THREADS **********
+****************************************/
+
+/*
+ * Gets the arena that the calling thread allocates from. A thread is given
+ * an arena round robin the first time it allocates.
+ * 
+ * Returns:
+ * The arena of the thread
+*/
+static arena_t *get_thread_arena(void) {
+
+#ifdef MM_THREADS
+    if(thread_arena == NULL)
+        thread_arena = &ctx->arenas[__sync_fetch_and_add(&ctx->next_arena, 1) % NUM_ARENAS];
+
+    return thread_arena;
+#else
+    return &ctx->arenas[0];
+#endif
+}
+
+/*
+ * Gets the arena that a block or slab slot belongs to
+ * 
+ * Input:
+ * bp - A pointer returned by mm_malloc
+ * 
+ * Returns:
+ * The arena owning the block
+*/
+static arena_t *get_block_arena(void *bp) {
+
+#ifdef MM_THREADS
+    return &ctx->arenas[ctx->page_arena[RUN_INDEX(bp)]];
+#else
+    return &ctx->arenas[0];
+#endif
+}
+
+#ifdef MM_THREADS
+/*
+ * Empties the thread cache by freeing every block in it to its arena. This
+ * is also the destructor of 'tcache_key', so it runs when a thread exits.
+ * 
+ * Input:
+ * arg - The thread cache
+*/
+static void tcache_flush(void *arg) {
+
+    tcache_t *cache = arg;
+
+    for(int i = 0; i < TCACHE_BINS; i++) {
+
+        while(cache->generation == ctx->generation && cache->bins[i] != NULL) {
+            void *bp = cache->bins[i];
+            cache->bins[i] = *(void **)bp;
+
+            arena_t *a = get_block_arena(bp);
+            LOCK(&a->lock);
+            arena_free(a, bp, 0);
+            UNLOCK(&a->lock);
+        }
+
+        cache->bins[i] = NULL;
+        cache->counts[i] = 0;
+    }
+}
+
+/*
+ * Creates the key whose destructor flushes the cache of an exiting thread
+*/
+static void tcache_create_key(void) {
+
+    pthread_key_create(&tcache_key, tcache_flush);
+}
+
+/*
+ * Drops the content of the thread cache if it was filled before the heap
+ * was reset by mm_init
+*/
+static void tcache_check_generation(void) {
+
+    if(tcache.generation == ctx->generation)
+        return;
+
+    memset(&tcache, 0, sizeof(tcache));
+    tcache.generation = ctx->generation;
+
+    // Make sure the cache is flushed when the thread exits
+    pthread_once(&tcache_key_once, tcache_create_key);
+    pthread_setspecific(tcache_key, &tcache);
+}
+
+/*
+ * Takes a block for the request from the thread cache
+ * 
+ * Input:
+ * size - The requested size
+ * 
+ * Returns:
+ * A cached block with room for the size or NULL if there is none
+*/
+static void *tcache_get(size_t size) {
+
+    if(size > TCACHE_MAX_SIZE)
+        return NULL;
+
+    tcache_check_generation();
+
+    // Every block in the bin has at least the rounded up size
+    int bin = (size + DSIZE - 1) / DSIZE;
+    void *bp = tcache.bins[bin];
+
+    if(bp != NULL) {
+        tcache.bins[bin] = *(void **)bp;
+        tcache.counts[bin]--;
+    }
+
+    return bp;
+}
+
+/*
+ * Puts a freed block in the thread cache
+ * 
+ * Inputs:
+ * bp - The block being freed
+ * size - The usable size of the block, or a smaller size that picks the bin
+ * 
+ * Returns:
+ * 1 if the block was cached, 0 if it has to be freed to its arena
+*/
+static int tcache_put(void *bp, size_t size) {
+
+    size_t bin = size / DSIZE;
+
+    if(bin >= TCACHE_BINS)
+        return 0;
+
+    tcache_check_generation();
+
+    if(tcache.counts[bin] >= TCACHE_COUNT)
+        return 0;
+
+    *(void **)bp = tcache.bins[bin];
+    tcache.bins[bin] = bp;
+    tcache.counts[bin]++;
+
+    return 1;
+}
+
+/*
+ * Pushes a block freed by a thread of another arena on the remote free
+ * stack of its arena. This never blocks: a failed compare and swap only
+ * means that another thread pushed a block in the meantime.
+ * 
+ * Inputs:
+ * a - The arena owning the block
+ * bp - The block being freed
+*/
+static void remote_free(arena_t *a, void *bp) {
+
+    void *head = __atomic_load_n(&a->remote_frees, __ATOMIC_RELAXED);
+
+    do {
+        *(void **)bp = head;
+    } while(!__atomic_compare_exchange_n(&a->remote_frees, &head, bp, 1,
+                                         __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/*
+ * Frees every block on the remote free stack of the arena. The whole stack
+ * is taken with a single exchange, so only the owner ever pops blocks and 
+ * the stack cannot suffer from the ABA problem. Must hold the arena lock.
+ * 
+ * Input:
+ * a - The arena to drain
+*/
+static void drain_remote_frees(arena_t *a) {
+
+    void *bp = __atomic_exchange_n(&a->remote_frees, NULL, __ATOMIC_ACQUIRE);
+
+    while(bp != NULL) {
+        void *next = *(void **)bp;
+        arena_free(a, bp, 0);
+        bp = next;
+    }
+}
+#endif
+
+/****************************************
+*************** CONTEXTS ****************
+****************************************/
+
+/*
+ * Creates a context for a memlib heap of its own. Its tables are sized for
+ * the limit of that heap, and mm_init must be called on it after it has 
+ * been selected with mm_set_context.
+ * 
+ * Input:
+ * heap - The memlib heap, which the context does not take over
+ * 
+ * Returns:
+ * The context, or NULL if there is no memory or the heap is larger than 
+ * MAX_HEAP_LIMIT
+*/
+mm_context_t *mm_context_create(mem_heap_t *heap) {
+
+    size_t runs = mem_maxheap_h(heap) / RUN_SIZE + 1;
+    mm_context_t *c;
+
+    if(mem_maxheap_h(heap) > MAX_HEAP_LIMIT || (c = calloc(1, sizeof(mm_context_t))) == NULL)
+        return NULL;
+
+    c->heap = heap;
+    c->run_map = calloc(runs / 32 + 1, sizeof(unsigned int));
+#ifdef MM_THREADS
+    c->page_arena = calloc(runs, 1);
+    pthread_mutex_init(&c->heap_lock, NULL);
+
+    if(c->page_arena == NULL) {
+        free(c->run_map);
+        c->run_map = NULL;
+    }
+#endif
+
+    if(c->run_map == NULL) {
+        mm_context_destroy(c);
+        return NULL;
+    }
+
+    return c;
+}
+
+/*
+ * Frees a context made by mm_context_create. Its blocks are gone with it,
+ * and its memlib heap is left to the caller. The calling thread goes back
+ * to the default context if it was using this one, and no other thread 
+ * may still use it.
+ * 
+ * Input:
+ * c - The context
+*/
+void mm_context_destroy(mm_context_t *c) {
+
+    if(ctx == c)
+        mm_set_context(NULL);
+
+#ifdef MM_THREADS
+    if(c->arena_locks_ready) {
+        for(int n = 0; n < NUM_ARENAS; n++)
+            pthread_mutex_destroy(&c->arenas[n].lock);
+    }
+    pthread_mutex_destroy(&c->heap_lock);
+    free(c->page_arena);
+#endif
+
+    free(c->run_map);
+    free(c);
+}
+
+/*
+ * Selects the context that the calling thread's calls of mm_init, 
+ * mm_malloc and the rest work on. The blocks in the thread cache are given
+ * back to the old context, and the thread is given an arena of the new one
+ * when it next allocates.
+ * 
+ * Input:
+ * c - The context, or NULL for the default one
+ * 
+ * Returns:
+ * The context that was selected before
+*/
+mm_context_t *mm_set_context(mm_context_t *c) {
+
+    mm_context_t *old = ctx;
+
+#ifdef MM_THREADS
+    tcache_flush(&tcache);
+    thread_arena = NULL;
+#endif
+
+    ctx = (c != NULL) ? c : &default_context;
+
+    return old;
 }
 
 /****************************************
@@ -579,33 +3074,67 @@ static void mm_check_size(int list_index, void *bp) {
 
     size_t size = GET_SIZE(HDRP(bp));
 
-    if(size > 16384 && list_index == 9)
-        return;
-    else if ((size <= 16384 || size > 8192) && list_index == 8 )
-        return;
-    else if ((size <= 8192 || size > 4096) && list_index == 7)
-        return;
-    else if ((size <= 4096 || size > 2048) && list_index == 6)
-        return;
-    else if((size <= 2048 || size > 1024) && list_index == 5)
-        return;
-    else if((size <= 1024 || size > 512) && list_index == 4)
-        return;
-    else if((size <= 512 || size > 256) && list_index == 3)
-        return;
-    else if((size <= 256 || size > 128) && list_index == 2)
-        return;
-    else if((size <= 128 || size > 64) && list_index == 1)
-        return;
-    else if(size <= 64 && list_index == 0)
-        return;
-    else {
+    if(get_free_list_index(size) != list_index) {
         printf("Block is not allocated in the correct list");
         abort();
     }
 }
 
 
+/*
+ * Checks that the tree of a size class is in the order of the fit policy,
+ * that every parent has a higher priority than its children, that every 
+ * node is a free block of the size class and that the largest block of 
+ * every subtree is right where the tree keeps it
+ * 
+ * Inputs:
+ * index - The size class of the tree
+ * root - The root of the tree or subtree
+*/
+static void mm_check_tree(int index, char *root) {
+
+    if(root == NULL)
+        return;
+
+    print_pointer_info("", root);
+    printf("\n");
+
+    // The header also carries PREV_ALLOC, so only the size and the allocated bit must match
+    if(GET_ALLOC(HDRP(root)) || GET_ALLOC(FTRP(root)) ||
+       GET_SIZE(HDRP(root)) != GET_SIZE(FTRP(root))) {
+        printf("There is an allocated or broken block in the tree \n");
+        abort();
+    }
+
+    mm_check_size(index, root);
+
+    char *left = LEFT_CHILD(root);
+    char *right = RIGHT_CHILD(root);
+
+    if(HAS_TREE_MAX(index)) {
+        unsigned int max = GET_SIZE(HDRP(root));
+
+        if(left != NULL)
+            max = MAX(max, GET(TREE_MAX(left)));
+        if(right != NULL)
+            max = MAX(max, GET(TREE_MAX(right)));
+
+        if(GET(TREE_MAX(root)) != max) {
+            printf("The largest block below %p is wrong \n", root);
+            abort();
+        }
+    }
+
+    if((left != NULL && (!TREE_LESS(left, root) || TREE_PRIORITY(left) > TREE_PRIORITY(root))) ||
+       (right != NULL && (!TREE_LESS(root, right) || TREE_PRIORITY(right) > TREE_PRIORITY(root)))) {
+        printf("The tree is out of order at %p \n", root);
+        abort();
+    }
+
+    mm_check_tree(index, left);
+    mm_check_tree(index, right);
+}
+
 /*
 Checks that the free lists is consistent
 
@@ -617,50 +3146,64 @@ static void mm_check(char *function_name) {
 
     printf("mm_check of %s \n", function_name);
 
-    for(int i = 0; i < num_free_lists; i++) {
-        void *current = free_lists[i];
+    for(int n = 0; n < NUM_ARENAS; n++) {
+        arena_t *a = &ctx->arenas[n];
 
-        if(current == NULL) {
-            printf("Nothing in free list nr. %d! \n \n", i);
-            continue;
-        }
+        for(int i = 0; i < NUM_FREE_LISTS; i++) {
+            void *current = a->free_lists[i];
+
+            // The bitmap must agree with the free list being empty or not
+            if((current != NULL) != ((a->free_map & MAP_BIT(i)) != 0)) {
+                printf("Bitmap does not match free list nr. %d! \n", i);
+                abort();
+            }
+
+            if(current == NULL) {
+                printf("Nothing in free list nr. %d! \n \n", i);
+                continue;
+            }
+
+            if(IS_TREE(i)) {
+                mm_check_tree(i, current);
+                continue;
+            }
 
-        // Go through heap
-        while(current != NULL) {
+            // Go through heap
+            while(current != NULL) {
 
-            print_pointer_info("", current);
+                print_pointer_info("", current);
             
-            int size_header = GET_SIZE(HDRP(current));
-            int alloc_header = GET_ALLOC(HDRP(current));
-            int alloc_footer = GET_ALLOC(FTRP(current));
-            int size_footer = GET_SIZE(FTRP(current));
+                int size_header = GET_SIZE(HDRP(current));
+                int alloc_header = GET_ALLOC(HDRP(current));
+                int alloc_footer = GET_ALLOC(FTRP(current));
+                int size_footer = GET_SIZE(FTRP(current));
 
-            void *next = NEXT_FREE_BLOCK(current);
+                void *next = NEXT_FREE_BLOCK(current);
             
 
-            if(GET_ALLOC(HDRP(current))) {
-                printf("There is something allocated in the free list \n");
-                abort();
-            }
+                if(GET_ALLOC(HDRP(current))) {
+                    printf("There is something allocated in the free list \n");
+                    abort();
+                }
 
 
-            if(next == current) {
-                printf("The current and next points to the same \n");
-                abort();
-            }
+                if(next == current) {
+                    printf("The current and next points to the same \n");
+                    abort();
+                }
 
-            if(size_footer != size_header || alloc_footer != alloc_header) {
-                printf("Header and footer does not match! \n");
-                abort();
-            }
+                if(size_footer != size_header || alloc_footer != alloc_header) {
+                    printf("Header and footer does not match! \n");
+                    abort();
+                }
 
-            mm_check_size(i, current);
+                mm_check_size(i, current);
 
-            printf("\n");
-            current = next;
+                printf("\n");
+                current = next;
+            }
         }
     }
-    
 
     printf("\n");
 }
@@ -5,6 +5,114 @@ extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
 
+/*
+ * Allocates a block whose payload is aligned to 'alignment', a power of
+ * two. The block is freed and reallocated like any other; a realloc that
+ * moves it keeps only the default alignment.
+ */
+extern void *mm_memalign(size_t alignment, size_t size);
+
+/*
+ * Frees a block like mm_free, given the size it was allocated (or last
+ * reallocated) with. A block small enough for the quick lists is freed
+ * without reading its header. Built with MM_DEBUG=1, mm.c aborts if the
+ * size does not fit the block.
+ */
+extern void mm_free_sized(void *ptr, size_t size);
+
+/*
+ * Allocates n objects of the same size into 'out' and returns how many
+ * were allocated (fewer than n only if the heap is full).
+ */
+extern int mm_malloc_batch(size_t size, int n, void **out);
+
+/*
+ * Frees n blocks, in any order. 'ptrs' is sorted by address in place, so
+ * neighbouring blocks are coalesced in one sweep.
+ */
+extern void mm_free_batch(void **ptrs, int n);
+
+/*
+ * Regions (mm-arena.c): objects are bumped out of chunks taken from
+ * mm_malloc and are all freed at once by mm_arena_reset or 
+ * mm_arena_destroy. They must not be passed to mm_free or mm_realloc.
+ * chunk_size 0 selects the default of 32 KiB. Like mm_malloc,
+ * mm_arena_alloc returns NULL for a size of 0.
+ */
+typedef struct mm_arena mm_arena_t;
+
+extern mm_arena_t *mm_arena_create(size_t chunk_size);
+extern void *mm_arena_alloc(mm_arena_t *arena, size_t size);
+extern void mm_arena_reset(mm_arena_t *arena);
+extern void mm_arena_destroy(mm_arena_t *arena);
+
+/*
+ * Contexts: each one is an allocator of its own over a memlib heap of its
+ * own (mem_heap_create), with no state shared with the others. A thread 
+ * works on the context it selected with mm_set_context (NULL selects the
+ * default context over the default heap), and mm_init starts a new heap in
+ * it. A block must be freed in the context it was allocated from. 
+ * mm_context_create returns NULL where the engine has no contexts.
+ */
+struct mem_heap;
+typedef struct mm_context mm_context_t;
+
+extern mm_context_t *mm_context_create(struct mem_heap *heap);
+extern void mm_context_destroy(mm_context_t *c);
+extern mm_context_t *mm_set_context(mm_context_t *c);
+
+/* Policies for choosing among the free blocks that fit a request */
+typedef enum {
+    MM_FIT_FIRST,   /* First block that fits, most recently freed first (default) */
+    MM_FIT_BEST,    /* Smallest block that fits */
+    MM_FIT_GOOD,    /* Smallest of the blocks seen in a bounded number of probes */
+    MM_FIT_ADDRESS  /* Lowest addressed block that fits */
+} mm_fit_policy_t;
+
+/* 
+ * Selects the fit policy. 'probes' bounds the search of MM_FIT_GOOD 
+ * (0 selects the default). Call it before mm_init, since size classes
+ * built under another policy keep their order.
+ */
+extern void mm_set_fit_policy(mm_fit_policy_t policy, int probes);
+
+/*
+ * Sets the size a free block at the end of the heap must reach before it
+ * is given back to memlib (0 never gives memory back). Half of the 
+ * threshold is kept, so a malloc/free loop does not shrink and grow the 
+ * heap over and over.
+ */
+extern void mm_set_trim_threshold(size_t threshold);
+
+/*
+ * Sets the request size from which mm_malloc maps a region of its own for
+ * the block instead of taking it from the heap (0 never maps).
+ */
+extern void mm_set_mmap_threshold(size_t threshold);
+
+/*
+ * Sets how many frees a large free block stays untouched before its pages
+ * are given back to the system (0 never gives them back). The block stays
+ * free, and its pages are faulted in again when it is reused.
+ */
+extern void mm_set_purge_decay(unsigned int decay);
+
+/* Counters of the allocator since the last mm_init */
+typedef struct {
+    unsigned long quick_lookups;  /* mallocs of a size that has a quick list */
+    unsigned long quick_hits;     /* ... that were served from the quick list */
+    unsigned long consolidations; /* passes that coalesced the quick lists */
+    unsigned long reallocs;       /* calls of mm_realloc with a block and a size */
+    unsigned long realloc_moves;  /* ... that had to move the block */
+    unsigned long bytes_copied;   /* payload bytes copied by mm_realloc */
+    unsigned long trims;          /* times the heap was shrunk */
+    unsigned long extensions;     /* times the heap was extended */
+    unsigned long purges;         /* free blocks whose pages were purged */
+    unsigned long bytes_purged;   /* ... resident bytes given back by that */
+} mm_stats_t;
+
+extern void mm_get_stats(mm_stats_t *stats);
+
 
 /* 
  * Students work in teams of one or two.  Teams enter their team name, 
@@ -0,0 +1,277 @@
+/*
+ * mtbench.c - Multi-threaded throughput benchmark for the thread-safe build
+ *             of mm.c (see the mtbench target in the Makefile).
+ *
+ * Every thread owns a table of slots and runs a random mix of mm_malloc and
+ * mm_free on it: an empty slot is filled with a block of a random size and
+ * a full slot is freed. The first and last byte of every block are written
+ * and checked, so blocks handed out twice are likely to be detected. The
+ * benchmark prints the total number of operations per second, which should
+ * grow with the number of threads.
+ *
+ * With -x, the given percentage of the frees is handed over to another
+ * random thread, which frees the block itself. This models producer and
+ * consumer threads and exercises the frees of blocks of foreign arenas.
+ *
+ * With -i, every thread runs on a heap of its own: it creates a memlib heap
+ * and an allocator context over it, so the threads share no allocator
+ * state at all. Blocks cannot be handed over then, so -i excludes -x.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+/* Parameters of a run, set from the command line */
+static int num_threads = 4;      /* number of threads */
+static long num_ops = 1000000;   /* operations per thread */
+static int num_slots = 1000;     /* blocks a thread can hold at once */
+static int max_size = 256;       /* largest request in bytes */
+static int cross_ratio = 0;      /* percentage of frees done by another thread */
+static int own_heaps = 0;        /* every thread runs on a heap of its own */
+
+/* Holds the state of one benchmark thread */
+typedef struct {
+    pthread_t tid;
+    int id;
+    unsigned int seed;
+    int errors;
+    long cross_frees;            /* blocks handed over to another thread */
+    void *inbox;                 /* blocks handed over by other threads */
+    size_t heap_size;            /* size of the thread's own heap */
+} worker_t;
+
+static worker_t *workers;
+
+/*
+ * next_random - xorshift generator, so the threads share no libc state
+ */
+static unsigned int next_random(unsigned int *state)
+{
+    unsigned int x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+/*
+ * hand_over - Give a block to another thread, which will free it
+ */
+static void hand_over(worker_t *to, void *bp)
+{
+    void *head = __atomic_load_n(&to->inbox, __ATOMIC_RELAXED);
+
+    do {
+        *(void **)bp = head;
+    } while (!__atomic_compare_exchange_n(&to->inbox, &head, bp, 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/*
+ * free_inbox - Free the blocks that other threads handed over to a thread
+ */
+static void free_inbox(worker_t *w)
+{
+    void *bp = __atomic_exchange_n(&w->inbox, NULL, __ATOMIC_ACQUIRE);
+
+    while (bp != NULL) {
+        void *next = *(void **)bp;
+        mm_free(bp);
+        bp = next;
+    }
+}
+
+/*
+ * run_worker - Run the random malloc/free mix of one thread
+ */
+static void *run_worker(void *arg)
+{
+    worker_t *w = arg;
+    char **slots = calloc(num_slots, sizeof(char *));
+    int *sizes = calloc(num_slots, sizeof(int));
+    mem_heap_t *heap = NULL;
+    mm_context_t *context = NULL;
+
+    if (slots == NULL || sizes == NULL) {
+        fprintf(stderr, "mtbench: calloc failed\n");
+        exit(1);
+    }
+
+    if (own_heaps) {
+        if ((heap = mem_heap_create(0, 0)) == NULL ||
+            (context = mm_context_create(heap)) == NULL) {
+            fprintf(stderr, "mtbench: cannot create the heap of thread %d\n", w->id);
+            exit(1);
+        }
+        mm_set_context(context);
+        if (mm_init() < 0) {
+            fprintf(stderr, "mtbench: mm_init failed\n");
+            exit(1);
+        }
+    }
+
+    for (long i = 0; i < num_ops; i++) {
+        int slot = next_random(&w->seed) % num_slots;
+        char tag = (char)(w->id + slot);
+
+        if (__atomic_load_n(&w->inbox, __ATOMIC_RELAXED) != NULL)
+            free_inbox(w);
+
+        if (slots[slot] == NULL) {
+            /* Room for the link of a block that is handed over */
+            int size = sizeof(void *) + next_random(&w->seed) % max_size;
+
+            if ((slots[slot] = mm_malloc(size)) == NULL) {
+                fprintf(stderr, "mtbench: mm_malloc(%d) failed\n", size);
+                exit(1);
+            }
+            sizes[slot] = size;
+            slots[slot][0] = tag;
+            slots[slot][size - 1] = tag;
+        } else {
+            if (slots[slot][0] != tag || slots[slot][sizes[slot] - 1] != tag)
+                w->errors++;
+
+            if (num_threads > 1 && (int)(next_random(&w->seed) % 100) < cross_ratio) {
+                int to = next_random(&w->seed) % (num_threads - 1);
+
+                hand_over(&workers[to < w->id ? to : to + 1], slots[slot]);
+                w->cross_frees++;
+            } else {
+                mm_free(slots[slot]);
+            }
+            slots[slot] = NULL;
+        }
+    }
+
+    for (int i = 0; i < num_slots; i++)
+        mm_free(slots[i]);
+
+    if (own_heaps) {
+        w->heap_size = mem_heapsize_h(heap);
+        mm_context_destroy(context);
+        mem_heap_destroy(heap);
+    }
+
+    free(slots);
+    free(sizes);
+    return NULL;
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: mtbench [-h] [-t <threads>] [-n <ops>] [-w <slots>] [-s <size>] [-x <percent>] [-i]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h          Print this message.\n");
+    fprintf(stderr, "\t-i          Run every thread on a heap of its own.\n");
+    fprintf(stderr, "\t-n <ops>    Operations per thread.\n");
+    fprintf(stderr, "\t-s <size>   Largest request in bytes.\n");
+    fprintf(stderr, "\t-t <threads> Number of threads.\n");
+    fprintf(stderr, "\t-w <slots>  Blocks a thread can hold at once.\n");
+    fprintf(stderr, "\t-x <percent> Frees handed over to another thread.\n");
+}
+
+int main(int argc, char **argv)
+{
+    int c;
+    int errors = 0;
+    long cross_frees = 0;
+    size_t heap_size;
+    struct timeval start, end;
+
+    while ((c = getopt(argc, argv, "ht:n:w:s:x:i")) != EOF) {
+        switch (c) {
+        case 't':
+            num_threads = atoi(optarg);
+            break;
+        case 'n':
+            num_ops = atol(optarg);
+            break;
+        case 'w':
+            num_slots = atoi(optarg);
+            break;
+        case 's':
+            max_size = atoi(optarg);
+            break;
+        case 'x':
+            cross_ratio = atoi(optarg);
+            break;
+        case 'i':
+            own_heaps = 1;
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+
+    if (num_threads < 1 || num_ops < 1 || num_slots < 1 || max_size < 1 ||
+        cross_ratio < 0 || cross_ratio > 100 || (own_heaps && cross_ratio > 0)) {
+        usage();
+        exit(1);
+    }
+
+    workers = calloc(num_threads, sizeof(worker_t));
+    if (workers == NULL) {
+        fprintf(stderr, "mtbench: calloc failed\n");
+        exit(1);
+    }
+
+    mem_init();
+    if (mm_init() < 0) {
+        fprintf(stderr, "mtbench: mm_init failed\n");
+        exit(1);
+    }
+
+    gettimeofday(&start, NULL);
+
+    for (int i = 0; i < num_threads; i++) {
+        workers[i].id = i;
+        workers[i].seed = 2463534242U + i * 7919;
+        pthread_create(&workers[i].tid, NULL, run_worker, &workers[i]);
+    }
+
+    for (int i = 0; i < num_threads; i++) {
+        pthread_join(workers[i].tid, NULL);
+        errors += workers[i].errors;
+        cross_frees += workers[i].cross_frees;
+    }
+
+    /* Blocks handed over to threads that had already finished */
+    for (int i = 0; i < num_threads; i++)
+        free_inbox(&workers[i]);
+
+    gettimeofday(&end, NULL);
+
+    heap_size = mem_heapsize();
+    for (int i = 0; i < num_threads; i++)
+        heap_size += workers[i].heap_size;
+
+    double secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+    double ops = (double)num_threads * num_ops;
+
+    printf("threads:%d ops:%.0f secs:%.3f Kops/sec:%.0f heap:%lu cross-frees:%ld\n",
+           num_threads, ops, secs, ops / 1e3 / secs, (unsigned long)heap_size,
+           cross_frees);
+
+    if (errors > 0) {
+        printf("ERROR: %d blocks were corrupted\n", errors);
+        exit(1);
+    }
+
+    mem_deinit();
+    return 0;
+}